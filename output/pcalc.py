@@ -0,0 +1,152 @@
+# =====================================
+# Python interface to libpcalc (make lib, see src/pcalc.h)
+# =====================================
+# usage:
+#   from pcalc import Calc
+#   c = Calc(terms='all', surface_cache='cache')   # parameters as in calc
+#   c.add_file('beta.dat')              # or c.add_elements(array (n, 48))
+#   c.finish()
+#   P = c.polarization('s')             # shape (len(c.pT), len(c.phi), 4)
+#   c.restart(tuning_factor=0.5)        # same surface, other parameters
+#   c.add_file('beta.dat'); c.finish()
+#
+# The element arrays are passed to the library without a copy if the 48
+# values of an element are consecutive float64 (e.g. an (n, 48) array or a
+# column slice of a wider table). The results (den, num) are numpy views of
+# the library's grids, valid until the next finish or restart; copy them to
+# keep them.
+# The library calls release the GIL (ctypes). The library is searched in
+# $PCALC_LIB, then as libpcalc*.so in the directory above this file.
+# There can be only one Calc at a time.
+
+import ctypes
+import glob
+import os
+import numpy as np
+
+ncols = 48  # values of a surface element, the columns of the surface file
+terms = ['s', 's_xi', 's_shear', 's_spin0']  # component names of the output
+
+def loadLibrary():
+ path = os.environ.get('PCALC_LIB')
+ if not path:
+  found = sorted(glob.glob(os.path.join(os.path.dirname(os.path.abspath(__file__)),
+    '..', 'libpcalc*.so')))
+  if not found:
+   raise OSError('libpcalc not found, build it with make lib or set PCALC_LIB')
+  path = found[0]
+ lib = ctypes.CDLL(path)
+ P, c_dp = ctypes.c_void_p, ctypes.POINTER(ctypes.c_double)
+ lib.pcalc_create.restype = P
+ lib.pcalc_destroy.argtypes = [P]
+ lib.pcalc_set.argtypes = [P, ctypes.c_char_p, ctypes.c_char_p]
+ lib.pcalc_init.argtypes = [P]
+ lib.pcalc_add_elements.argtypes = [P, c_dp, ctypes.c_size_t, ctypes.c_size_t]
+ lib.pcalc_add_file.argtypes = [P, ctypes.c_char_p]
+ lib.pcalc_finish.argtypes = [P]
+ lib.pcalc_restart.argtypes = [P]
+ lib.pcalc_elements.argtypes = [P]
+ lib.pcalc_elements.restype = ctypes.c_long
+ lib.pcalc_grid.argtypes = [P, ctypes.POINTER(ctypes.c_int), ctypes.POINTER(c_dp),
+   ctypes.POINTER(ctypes.c_int), ctypes.POINTER(c_dp)]
+ lib.pcalc_weights.argtypes = [P, ctypes.POINTER(c_dp), ctypes.POINTER(c_dp)]
+ lib.pcalc_denominator.argtypes = [P]
+ lib.pcalc_denominator.restype = c_dp
+ lib.pcalc_numerator.argtypes = [P, ctypes.c_int]
+ lib.pcalc_numerator.restype = c_dp
+ lib.pcalc_norm.argtypes = [P, ctypes.c_int]
+ lib.pcalc_norm.restype = ctypes.c_double
+ lib.pcalc_write.argtypes = [P, ctypes.c_char_p]
+ return lib
+
+class Calc:
+ def __init__(self, params=None, **keys):
+  self.lib = loadLibrary()
+  self.ctx = self.lib.pcalc_create()
+  if not self.ctx:
+   raise RuntimeError('there is already a Calc in this process')
+  if params:
+   self.set('params', params)
+  self.set(**keys)
+  self.check(self.lib.pcalc_init(self.ctx), 'init')
+  self.grid()
+
+ # momentum grid and quadrature weights, after init and restart
+ def grid(self):
+  npt, nphi = ctypes.c_int(), ctypes.c_int()
+  pT, phi = ctypes.POINTER(ctypes.c_double)(), ctypes.POINTER(ctypes.c_double)()
+  self.lib.pcalc_grid(self.ctx, ctypes.byref(npt), ctypes.byref(pT),
+    ctypes.byref(nphi), ctypes.byref(phi))
+  self.pT = np.ctypeslib.as_array(pT, (npt.value,)).copy()
+  self.phi = np.ctypeslib.as_array(phi, (nphi.value,)).copy()
+  # quadrature weights of dpT and dphi (pt_grid)
+  wpt, wphi = ctypes.POINTER(ctypes.c_double)(), ctypes.POINTER(ctypes.c_double)()
+  self.lib.pcalc_weights(self.ctx, ctypes.byref(wpt), ctypes.byref(wphi))
+  self.wpt = np.ctypeslib.as_array(wpt, (npt.value,)).copy()
+  self.wphi = np.ctypeslib.as_array(wphi, (nphi.value,)).copy()
+
+ def __del__(self):
+  if getattr(self, 'ctx', None):
+   self.lib.pcalc_destroy(self.ctx)
+   self.ctx = None
+
+ def check(self, ret, what):
+  if ret != 0:
+   raise RuntimeError('pcalc ' + what + ' failed')
+
+ # parameters as in params/example.params, e.g. set(tuning_factor=0.5) or
+ # set('terms', 'all')
+ def set(self, key=None, value=None, **keys):
+  if key is not None:
+   keys[key] = value
+  for k, v in keys.items():
+   self.check(self.lib.pcalc_set(self.ctx, k.encode(), str(v).encode()), 'set ' + k)
+
+ # elements: float64 array (n, 48) in the column order of the surface file,
+ # or (n, m > 48) with the element values in the first 48 columns
+ def add_elements(self, elements):
+  a = np.asarray(elements)
+  if a.ndim != 2 or a.shape[1] < ncols:
+   raise ValueError('elements must have the shape (n, %d)' % ncols)
+  if a.dtype != np.float64 or a.strides[1] != 8 or a.strides[0] % 8:
+   a = np.ascontiguousarray(a[:, :ncols], dtype=np.float64)
+  ptr = a.ctypes.data_as(ctypes.POINTER(ctypes.c_double))
+  self.check(self.lib.pcalc_add_elements(self.ctx, ptr, a.shape[0], a.strides[0] // 8),
+    'add_elements')
+
+ def add_file(self, filename):
+  self.check(self.lib.pcalc_add_file(self.ctx, filename.encode()), 'add_file')
+
+ def finish(self):
+  self.check(self.lib.pcalc_finish(self.ctx), 'finish')
+  shape = (len(self.pT), len(self.phi))
+  self.den = np.ctypeslib.as_array(self.lib.pcalc_denominator(self.ctx), shape)
+  self.num = {}
+  for it, name in enumerate(terms):
+   p = self.lib.pcalc_numerator(self.ctx, it)
+   if p:
+    self.num[name] = np.ctypeslib.as_array(p, shape + (4,))
+
+ # new surface with the current parameters and the given changes
+ def restart(self, **keys):
+  self.set(**keys)
+  self.check(self.lib.pcalc_restart(self.ctx), 'restart')
+  self.den, self.num = None, {}  # the library's grids are set up again
+  self.grid()
+
+ def elements(self):
+  return self.lib.pcalc_elements(self.ctx)
+
+ # polarization P^mu of a term, shape (len(pT), len(phi), 4)
+ def polarization(self, term='s'):
+  it = terms.index(term)
+  return self.lib.pcalc_norm(self.ctx, it) * self.num[term] / self.den[..., None]
+
+ # yield-weighted mean of the polarization over the grid (pT dpT dphi)
+ def mean_polarization(self, term='s'):
+  w = (self.pT*self.wpt)[:, None]*self.wphi[None, :]
+  return (self.lib.pcalc_norm(self.ctx, terms.index(term))
+          * (self.num[term]*w[..., None]).sum(axis=(0, 1)) / (self.den*w).sum())
+
+ def write(self, filename):
+  self.check(self.lib.pcalc_write(self.ctx, filename.encode()), 'write')
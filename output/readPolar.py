@@ -0,0 +1,89 @@
+# =====================================
+# reader for the binary output of calc
+# (output file name ending with .bin)
+# =====================================
+# usage:
+#   from readPolar import readPolar
+#   hdr, pT, phi, data = readPolar('rhic200.20-50.bin')
+#   data.shape == (len(pT), len(phi), number of components)
+#   data[..., hdr['components'].index('s^2')]
+
+import numpy as np
+import sys
+
+def readPolar(filename):
+ with open(filename, 'rb') as f:
+  buf = f.read()
+ if buf[:8] != b'PCALCBIN':
+  raise ValueError(filename + ' is not a binary calc output')
+ version, hlen = np.frombuffer(buf, dtype=np.uint32, count=2, offset=8)
+ hdr = {}
+ for line in buf[16:16+hlen].decode().splitlines():
+  key, _, value = line.partition(' ')
+  hdr[key] = value
+ hdr['version'] = int(version)
+ hdr['dims'] = [int(x) for x in hdr['dims'].split()]
+ hdr['components'] = hdr['components'].split()
+ hdr['norm'] = [float(x) for x in hdr['norm'].split()]
+ for key in ('weights_pt', 'weights_phi'):
+  if key in hdr:
+   hdr[key] = np.array([float(x) for x in hdr[key].split()])
+ dimP, dimPhi = hdr['dims']
+ nComp = len(hdr['components'])
+ offset = 16 + hlen
+ pT = np.frombuffer(buf, dtype=np.float64, count=dimP, offset=offset)
+ offset += 8*dimP
+ phi = np.frombuffer(buf, dtype=np.float64, count=dimPhi, offset=offset)
+ offset += 8*dimPhi
+ data = np.frombuffer(buf, dtype=np.float64, count=dimP*dimPhi*nComp,
+   offset=offset).reshape((dimP, dimPhi, nComp))
+ return hdr, pT, phi, data
+
+# flat columns in the same order as the text output:
+# pT, phi, then all components
+def readPolarColumns(filename):
+ hdr, pT, phi, data = readPolar(filename)
+ dimP, dimPhi = hdr['dims']
+ cols = [np.repeat(pT, dimPhi), np.tile(phi, dimP)]
+ cols += [data[:, :, i].ravel() for i in range(data.shape[2])]
+ return hdr, np.array(cols)
+
+# weights w[ipt, iphi] of the integral over d^2pT = pT dpT dphi on the grid,
+# e.g. the yield (data[..., 0]*w).sum() or the mean of a component c:
+# (data[..., 0]*data[..., c]*w).sum()/(data[..., 0]*w).sum() for P*, or
+# (data[..., c]*w).sum()/(data[..., 0]*w).sum() for the numerators. Files
+# without weights (older versions) have the uniform grid, with the step
+# (rectangle rule) as the weight.
+def gridWeights(hdr, pT, phi):
+ if 'weights_pt' in hdr:
+  wpt, wphi = hdr['weights_pt'], hdr['weights_phi']
+ else:
+  wpt = np.full(len(pT), pT[1] - pT[0] if len(pT) > 1 else 1.)
+  wphi = np.full(len(phi), 2*np.pi/len(phi))
+ return (pT*wpt)[:, None]*wphi[None, :]
+
+# histograms of the invariants mode in binary format (.bin): returns a dict
+# name -> (bin centers, densities, header fields)
+def readHist(filename):
+ with open(filename, 'rb') as f:
+  buf = f.read()
+ if buf[:8] != b'PCALCHST':
+  raise ValueError(filename + ' is not a binary calc histogram file')
+ version, hlen = np.frombuffer(buf, dtype=np.uint32, count=2, offset=8)
+ offset = 16 + hlen
+ hists = {}
+ for line in buf[16:16+hlen].decode().splitlines():
+  f = line.split()
+  name, nbins = f[0], int(f[1])
+  xmin, xmax, entries, under, over, nan = [float(x) for x in f[2:8]]
+  dens = np.frombuffer(buf, dtype=np.float64, count=nbins, offset=offset)
+  offset += 8*nbins
+  x = xmin + (np.arange(nbins) + 0.5)*(xmax - xmin)/nbins
+  hists[name] = (x, dens, {'entries': entries, 'underflow': under,
+                           'overflow': over, 'nan': nan})
+ return hists
+
+if __name__ == '__main__':
+ hdr, pT, phi, data = readPolar(sys.argv[1])
+ for key in hdr:
+  print(key, ':', hdr[key])
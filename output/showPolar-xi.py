@@ -26,10 +26,14 @@ figHeight = 4.0 # in inches
 file = sys.argv[1]
 file_dim = file+'.dim'
 
-dimP = 16
-dimPhi = 40
-
-dimP, dimPhi = np.loadtxt(file_dim, dtype=int)
+if file.endswith('.bin'):
+ # binary output is self-describing: grid dimensions come from its header
+ from readPolar import readPolarColumns
+ hdr, a = readPolarColumns(file)
+ dimP, dimPhi = hdr['dims']
+else:
+ dimP, dimPhi = np.loadtxt(file_dim, dtype=int)
+ a = np.loadtxt(file, unpack=True)
 print(dimP)
 #dndp = np.array([0.0] * dimP * dimPhi)
 #Pizu = []
@@ -41,7 +45,6 @@ print(dimP)
 #for i in range(len(files)):
  #Piz.append(np.array([0.0] * dim))
 
-a = np.loadtxt(file, unpack=True)
 pT = a[0]
 phi = a[1]
 dndp = a[2]
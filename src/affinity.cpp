@@ -0,0 +1,46 @@
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#endif
+#include <omp.h>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "affinity.h"
+
+using namespace std;
+
+void pinThreads() {
+ if (getenv("OMP_PROC_BIND")) {
+  cout << "pinThreads: OMP_PROC_BIND is set, leaving the binding to OpenMP\n";
+  return;
+ }
+#ifdef __linux__
+ cpu_set_t allowed;
+ CPU_ZERO(&allowed);
+ if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+  cout << "pinThreads: cannot read the affinity mask, threads not pinned\n";
+  return;
+ }
+ vector<int> cpus;
+ for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+  if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+ int nFailed = 0;
+ #pragma omp parallel reduction(+:nFailed)
+ {
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  CPU_SET(cpus[omp_get_thread_num() % cpus.size()], &mask);
+  if (sched_setaffinity(0, sizeof(mask), &mask) != 0) nFailed++;
+ }
+ cout << "pinThreads: " << omp_get_max_threads() << " threads on "
+      << cpus.size() << " cpus";
+ if (nFailed > 0) cout << ", " << nFailed << " failed";
+ cout << endl;
+#else
+ cout << "pinThreads: not supported on this system\n";
+#endif
+}
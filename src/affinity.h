@@ -0,0 +1,10 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+// Pins each OpenMP thread to one CPU of the process affinity mask, thread i
+// to the i-th allowed CPU, so that the threads which first touched a part of
+// the surface keep running on the NUMA node holding it. Does nothing if
+// OMP_PROC_BIND is set (the OpenMP runtime pins then) or on non-Linux systems.
+void pinThreads();
+
+#endif // AFFINITY_H
@@ -0,0 +1,374 @@
+#include <omp.h>
+#include <zlib.h>
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#include "compression.h"
+
+using namespace std;
+
+// receives the decompressed data in chunks; returns false to stop
+typedef function<bool(const char *, size_t)> chunkSink;
+// supplies the compressed data in chunks: sets the pointer and returns the
+// size of the next chunk, 0 at the end
+typedef function<size_t(const char *&)> chunkSource;
+
+// a part of the compressed file which can be decompressed on its own
+struct compressedPart {
+ size_t offset, size;
+};
+
+const size_t chunkSize = 1 << 20;      // output chunk, input chunk of sequential parts
+const size_t maxQueued = 64 << 20;     // decompressed bytes ahead of the parser
+const int partsPerThread = 16;         // parts per thread in a batch
+
+int detectCompression(const string &filename) {
+ ifstream fin(filename.c_str(), ios::in | ios::binary);
+ unsigned char magic[4] = {0, 0, 0, 0};
+ fin.read((char *)magic, 4);
+ if (magic[0] == 0x1f && magic[1] == 0x8b) return COMPRESSION_GZIP;
+ if (magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+  return COMPRESSION_ZSTD;
+ return COMPRESSION_NONE;
+}
+
+const char *compressionName(int format) {
+ switch (format) {
+  case COMPRESSION_GZIP: return "gzip";
+  case COMPRESSION_ZSTD: return "zstd";
+ }
+ return "none";
+}
+
+// the data [src, src+n) as a source, in chunks of at most 1 GB (avail_in
+// of zlib is 32 bit)
+chunkSource memorySource(const char *src, size_t n) {
+ size_t pos = 0;
+ return [src, n, pos](const char *&p) mutable {
+  const size_t len = min(n - pos, (size_t)1 << 30);
+  p = src + pos;
+  pos += len;
+  return len;
+ };
+}
+
+// Decompresses a gzip part, which may consist of several members, into
+// chunks of at most chunkSize bytes. Returns an error message or "".
+string inflatePart(const chunkSource &in, const chunkSink &out) {
+ z_stream zs;
+ memset(&zs, 0, sizeof(zs));
+ if (inflateInit2(&zs, 15 + 32) != Z_OK) return "inflateInit failed";
+ vector<char> chunk(chunkSize);
+ const char *src;
+ string error;
+ while (true) {
+  if (zs.avail_in == 0) {
+   zs.avail_in = in(src);
+   zs.next_in = (Bytef *)src;
+  }
+  zs.next_out = (Bytef *)&chunk[0];
+  zs.avail_out = chunk.size();
+  const int ret = inflate(&zs, Z_NO_FLUSH);
+  if (ret != Z_OK && ret != Z_STREAM_END) {
+   error = ret == Z_BUF_ERROR ? "unexpected end of the gzip data"
+                              : (zs.msg ? zs.msg : "inflate failed");
+   break;
+  }
+  if (!out(&chunk[0], chunk.size() - zs.avail_out)) break;
+  if (ret == Z_STREAM_END) {
+   if (zs.avail_in == 0) {
+    zs.avail_in = in(src);
+    zs.next_in = (Bytef *)src;
+    if (zs.avail_in == 0) break;
+   }
+   inflateReset(&zs);  // next member
+  }
+ }
+ inflateEnd(&zs);
+ return error;
+}
+
+#ifdef USE_ZSTD
+// decompresses zstd frames into chunks of chunkSize
+string zstdPart(const chunkSource &in, const chunkSink &out) {
+ ZSTD_DStream *ds = ZSTD_createDStream();
+ ZSTD_initDStream(ds);
+ vector<char> chunk(chunkSize);
+ ZSTD_inBuffer buf = {0, 0, 0};
+ size_t ret = 0;
+ string error;
+ // zstd keeps the last byte of a frame until all its output is flushed
+ while (true) {
+  if (buf.pos == buf.size) {
+   const char *src;
+   buf.size = in(src);
+   buf.src = src;
+   buf.pos = 0;
+   if (buf.size == 0) break;
+  }
+  ZSTD_outBuffer o = {&chunk[0], chunk.size(), 0};
+  ret = ZSTD_decompressStream(ds, &o, &buf);
+  if (ZSTD_isError(ret)) {
+   error = ZSTD_getErrorName(ret);
+   break;
+  }
+  if (!out(&chunk[0], o.pos)) break;
+ }
+ if (error.empty() && buf.size == 0 && ret != 0)
+  error = "unexpected end of the zstd data";
+ ZSTD_freeDStream(ds);
+ return error;
+}
+#endif
+
+string decompressPart(int format, const chunkSource &in, const chunkSink &out) {
+ if (format == COMPRESSION_ZSTD) {
+#ifdef USE_ZSTD
+  return zstdPart(in, out);
+#else
+  return "zstd compressed, calc is built without zstd (see Makefile)";
+#endif
+ }
+ return inflatePart(in, out);
+}
+
+// reads n bytes at pos of the file
+bool readAt(ifstream &fin, size_t pos, unsigned char *dst, size_t n) {
+ fin.clear();
+ fin.seekg(pos);
+ fin.read((char *)dst, n);
+ return (size_t)fin.gcount() == n;
+}
+
+inline unsigned int readU16(const unsigned char *d) {
+ return d[0] | (d[1] << 8);
+}
+
+inline unsigned int readU32(const unsigned char *d) {
+ return readU16(d) | (readU16(d + 2) << 16);
+}
+
+// Splits a gzip file of fileSize bytes into its BGZF blocks: members with
+// the extra field "BC", which holds the size of the member. Only the
+// headers are read. Returns false (one part) for other gzip files.
+bool splitBgzf(ifstream &fin, size_t fileSize, vector<compressedPart> &parts) {
+ unsigned char h[12], extra[1 << 16];
+ for (size_t pos = 0; pos < fileSize;) {
+  if (!readAt(fin, pos, h, 12) || h[0] != 0x1f || h[1] != 0x8b || !(h[3] & 4))
+   return false;
+  const size_t xlen = readU16(h + 10);
+  if (!readAt(fin, pos + 12, extra, xlen)) return false;
+  size_t bsize = 0;
+  for (size_t i = 0; i + 4 <= xlen;) {
+   const size_t slen = readU16(extra + i + 2);
+   if (extra[i] == 'B' && extra[i + 1] == 'C' && slen == 2 && i + 6 <= xlen)
+    bsize = readU16(extra + i + 4) + 1;
+   i += 4 + slen;
+  }
+  if (bsize == 0 || pos + bsize > fileSize) return false;
+  compressedPart p = {pos, bsize};
+  parts.push_back(p);
+  pos += bsize;
+ }
+ return true;
+}
+
+// Splits a zstd file of fileSize bytes into its frames (including
+// skippable frames). The size of a frame follows from its header and the
+// headers of its blocks, which are the only parts read.
+bool splitZstd(ifstream &fin, size_t fileSize, vector<compressedPart> &parts) {
+ for (size_t pos = 0; pos < fileSize;) {
+  unsigned char h[8];
+  if (!readAt(fin, pos, h, 5)) return false;
+  const unsigned int magic = readU32(h);
+  size_t end;
+  if ((magic & 0xfffffff0) == 0x184d2a50) {
+   if (!readAt(fin, pos, h, 8)) return false;
+   end = pos + 8 + readU32(h + 4);
+  } else if (magic == 0xfd2fb528) {
+   // frame header: descriptor, window, dictionary id, content size
+   const unsigned char fhd = h[4];
+   const int fcsFlag = fhd >> 6, single = (fhd >> 5) & 1;
+   const int dictSize[4] = {0, 1, 2, 4};
+   end = pos + 5 + !single + dictSize[fhd & 3] + (fcsFlag == 0 ? single : 1 << fcsFlag);
+   // blocks: 3 byte header with last flag, type and size (1 byte for RLE)
+   bool last = false;
+   while (!last) {
+    if (!readAt(fin, end, h, 3)) return false;
+    const unsigned int bh = h[0] | (h[1] << 8) | (h[2] << 16);
+    const int type = (bh >> 1) & 3;
+    if (type == 3) return false;
+    last = bh & 1;
+    end += 3 + (type == 1 ? 1 : bh >> 3);
+   }
+   if (fhd & 4) end += 4;  // content checksum
+  } else
+   return false;
+  if (end > fileSize) return false;
+  compressedPart p = {pos, end - pos};
+  parts.push_back(p);
+  pos = end;
+ }
+ return true;
+}
+
+DecompressBuf::DecompressBuf(const string &_filename, int _format, int _nThreads)
+    : filename(_filename),
+      format(_format),
+      nThreads(max(_nThreads, 1)),
+      queued(0),
+      done(false),
+      stopped(false) {
+ setg(0, 0, 0);
+ producer = thread(&DecompressBuf::run, this);
+}
+
+DecompressBuf::~DecompressBuf() {
+ {
+  lock_guard<mutex> lock(mtx);
+  stopped = true;
+ }
+ cv.notify_all();
+ producer.join();
+}
+
+// queues a decompressed block, waits while the parser is far behind;
+// returns false if the stream is closed
+bool DecompressBuf::push(string &block) {
+ unique_lock<mutex> lock(mtx);
+ cv.wait(lock, [this] { return queued < maxQueued || stopped; });
+ if (stopped) return false;
+ queued += block.size();
+ blocks.push_back(string());
+ blocks.back().swap(block);
+ cv.notify_all();
+ return true;
+}
+
+void DecompressBuf::run() {
+ string err;
+ ifstream fin(filename.c_str(), ios::in | ios::binary);
+ fin.seekg(0, ios::end);
+ const size_t fileSize = max((long long)fin.tellg(), 0LL);
+ if (!fin) err = "cannot read the file";
+ vector<compressedPart> parts;
+ if (err.empty() && fileSize > 0) {
+  if (format == COMPRESSION_ZSTD) {
+#ifndef USE_ZSTD
+   err = "zstd compressed, calc is built without zstd (see Makefile)";
+#endif
+   if (err.empty() && !splitZstd(fin, fileSize, parts)) err = "invalid zstd data";
+  } else if (!splitBgzf(fin, fileSize, parts)) {
+   parts.clear();
+   compressedPart p = {0, fileSize};
+   parts.push_back(p);
+  }
+ }
+ fin.clear();
+ fin.seekg(0);
+ if (err.empty() && parts.size() == 1) {
+  // one part: read and decompressed sequentially, the chunks are queued as
+  // they come
+  vector<char> input(chunkSize);
+  err = decompressPart(format,
+   [&fin, &input](const char *&p) {
+    fin.read(&input[0], input.size());
+    p = &input[0];
+    return (size_t)fin.gcount();
+   },
+   [this](const char *p, size_t n) {
+    string block(p, n);
+    return push(block);
+   });
+ } else if (err.empty()) {
+  // batches of parts read, decompressed in parallel, then queued in order;
+  // the parts are consecutive in the file
+  const int batch = nThreads * partsPerThread;
+  bool open = true;
+  vector<char> input;
+  for (size_t i0 = 0; i0 < parts.size() && err.empty() && open; i0 += batch) {
+   const int n = min(parts.size() - i0, (size_t)batch);
+   const size_t first = parts[i0].offset;
+   input.resize(parts[i0 + n - 1].offset + parts[i0 + n - 1].size - first);
+   if (!fin.read(&input[0], input.size())) {
+    err = "cannot read the file";
+    break;
+   }
+   vector<string> out(n), errors(n);
+   #pragma omp parallel for schedule(dynamic) num_threads(nThreads)
+   for (int k = 0; k < n; k++) {
+    const compressedPart &p = parts[i0 + k];
+    string &s = out[k];
+    errors[k] = decompressPart(format, memorySource(&input[p.offset - first], p.size),
+                               [&s](const char *c, size_t m) {
+     s.append(c, m);
+     return true;
+    });
+   }
+   for (int k = 0; k < n && err.empty() && open; k++) {
+    err = errors[k];
+    if (err.empty() && !out[k].empty()) open = push(out[k]);
+   }
+  }
+ }
+ lock_guard<mutex> lock(mtx);
+ error = err;
+ done = true;
+ cv.notify_all();
+}
+
+int DecompressBuf::underflow() {
+ if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+ unique_lock<mutex> lock(mtx);
+ while (true) {
+  cv.wait(lock, [this] { return !blocks.empty() || done; });
+  if (blocks.empty()) break;
+  current.swap(blocks.front());
+  blocks.pop_front();
+  queued -= current.size();
+  cv.notify_all();
+  if (!current.empty()) {
+   setg(&current[0], &current[0], &current[0] + current.size());
+   return traits_type::to_int_type(*gptr());
+  }
+ }
+ if (!error.empty()) {
+  cout << "cannot decompress " << filename << ": " << error << endl;
+  exit(1);
+ }
+ return traits_type::eof();
+}
+
+DecompressStream::DecompressStream(const string &filename, int format, int nThreads)
+    : istream(0), buf(filename, format, nThreads) {
+ rdbuf(&buf);
+}
+
+istream *openInput(const string &filename) {
+ const int format = detectCompression(filename);
+ if (format == COMPRESSION_NONE) return new ifstream(filename.c_str());
+ return new DecompressStream(filename, format, omp_get_max_threads());
+}
+
+long long countLines(const string &filename) {
+ istream *fin = openInput(filename);
+ long long nlines = -1;
+ if (*fin) {
+  // a last line without newline is not counted
+  vector<char> buf(1 << 20);
+  nlines = 0;
+  streamsize n;
+  while ((n = fin->rdbuf()->sgetn(&buf[0], buf.size())) > 0)
+   for (streamsize i = 0; i < n; i++)
+    if (buf[i] == '\n') nlines++;
+ }
+ delete fin;
+ return nlines;
+}
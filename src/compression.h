@@ -0,0 +1,64 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <condition_variable>
+#include <deque>
+#include <istream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// compression of the input files, detected from the first bytes
+enum { COMPRESSION_NONE = 0, COMPRESSION_GZIP = 1, COMPRESSION_ZSTD = 2 };
+
+int detectCompression(const std::string &filename);
+const char *compressionName(int format);
+
+// Stream buffer over the decompressed content of a gzip or zstd (with
+// USE_ZSTD) file. The file is split into its independently compressed
+// parts from their headers: the blocks of a BGZF file (bgzip) or the frames
+// of a zstd file (pzstd, zstd --format with several frames). A background
+// thread reads them in batches, decompresses each batch with nThreads
+// OpenMP threads and queues the output in order, so the decompression runs
+// in parallel with the parsing. A file with one part (plain gzip, one zstd
+// frame) is read and decompressed sequentially by the background thread.
+// Only a batch of the compressed file is held in memory.
+class DecompressBuf : public std::streambuf {
+public:
+ DecompressBuf(const std::string &filename, int format, int nThreads);
+ ~DecompressBuf();
+
+protected:
+ int underflow();
+
+private:
+ std::string filename;
+ int format, nThreads;
+ std::deque<std::string> blocks; // decompressed output, in file order
+ std::string current;            // the block being read
+ size_t queued;                  // bytes in blocks
+ bool done, stopped;
+ std::string error;
+ std::thread producer;
+ std::mutex mtx;
+ std::condition_variable cv;
+ void run();
+ bool push(std::string &block);
+};
+
+// istream over a compressed file, see DecompressBuf
+class DecompressStream : public std::istream {
+public:
+ DecompressStream(const std::string &filename, int format, int nThreads);
+
+private:
+ DecompressBuf buf;
+};
+
+// opens a plain or compressed text file for reading; the caller deletes it
+std::istream *openInput(const std::string &filename);
+// number of newlines of a plain or compressed text file, -1 if it cannot
+// be read
+long long countLines(const std::string &filename);
+
+#endif // COMPRESSION_H
@@ -0,0 +1,309 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+
+#include "config.h"
+
+using namespace std;
+
+Config config;
+
+vector<string> splitList(const string &value);
+vector<double> parseNumbers(const string &value);
+
+Config::Config()
+    : mode(MODE_POLARIZATION),
+      nBins(100),
+      plots(false),
+      terms(TERM_STANDARD | TERM_SHEAR),
+      pid(3122),
+      nThreads(0),
+      schedule("dynamic"),
+      grain(64),
+      firstTouch(true),
+      pinThreads(false),
+      kernel("gemm"),
+      tiling("off"),
+      tileElements(128),
+      tileMomenta(64),
+      surfaceCache(""),
+      precision("double"),
+      compensatedSum(false),
+      particleTable("Tb/ptl3.data"),
+      decayTable("Tb/dky3.mar.data"),
+      coefficientFile("/Users/nils/Desktop/Projects/Polarization/Coefficients/coeffData.csv"),
+      interpolationTable("interpolationTable.txt"),
+      outputFormat("auto"),
+      restFrame(false),
+      harmonics(0),
+      ptMin(0.0),
+      ptMax(3.0),
+      nPt(16),
+      nPhi(40),
+      ptGrid("uniform"),
+      ptScale(0.3),
+      ptMinInt(0.4),
+      ptMaxInt(10.0),
+      tuningFactor(0.37),
+      kappaCoefficient(-11.5),
+      kappaTuningFactor(1.0),
+      follow(false),
+      followEnd("END"),
+      followChunk(100000),
+      followInterval(1.0),
+      followTimeout(0.0),
+      boostInvariant(false),
+      boostInvariantDeta(0.0),
+      globalNY(8),
+      globalNPt(12),
+      globalPtScale(0.3),
+      globalNPhi(24),
+      progressInterval(10.0),
+      heartbeatFile("") {
+ invariants = splitList("symm,asymm,mod");
+ globalYBins = parseNumbers("-1,1");
+}
+
+const char *termName(int term) {
+ switch (term) {
+  case TERM_STANDARD: return "standard";
+  case TERM_XI: return "xi";
+  case TERM_SHEAR: return "shear";
+  case TERM_SPIN0: return "spin0";
+ }
+ return "unknown";
+}
+
+const char *modeName(int mode) {
+ switch (mode) {
+  case MODE_POLARIZATION: return "polarization";
+  case MODE_INVARIANTS: return "invariants";
+  case MODE_GLOBAL: return "global";
+ }
+ return "unknown";
+}
+
+int parseTerms(const string &value) {
+ if (value == "all") return TERM_STANDARD | TERM_XI | TERM_SHEAR | TERM_SPIN0;
+ if (value == "none") return 0;
+ int terms = 0;
+ istringstream list(value);
+ string item;
+ while (getline(list, item, ',')) {
+  int term = 0;
+  for (int t = 1; t < (1 << nTerms); t <<= 1)
+   if (item == termName(t)) term = t;
+  if (term == 0) {
+   cout << "unknown polarization term: " << item << endl;
+   exit(1);
+  }
+  terms |= term;
+ }
+ return terms;
+}
+
+vector<string> splitList(const string &value) {
+ vector<string> items;
+ istringstream list(value);
+ string item;
+ while (getline(list, item, ','))
+  if (!item.empty()) items.push_back(item);
+ return items;
+}
+
+vector<double> parseNumbers(const string &value) {
+ vector<string> items = splitList(value);
+ vector<double> numbers;
+ for (int i = 0; i < items.size(); i++) numbers.push_back(atof(items[i].c_str()));
+ return numbers;
+}
+
+bool isScan(const Config &cfg) {
+ return !cfg.scanTuningFactors.empty() || !cfg.scanKappaTuningFactors.empty()
+        || !cfg.scanCoefficientFiles.empty();
+}
+
+bool setParam(Config &cfg, const string &key, const string &value) {
+ if (key == "mode") {
+  if (value == "polarization") cfg.mode = MODE_POLARIZATION;
+  else if (value == "invariants") cfg.mode = MODE_INVARIANTS;
+  else if (value == "global") cfg.mode = MODE_GLOBAL;
+  else {
+   cout << "unknown mode: " << value << endl;
+   exit(1);
+  }
+ }
+ else if (key == "invariants") cfg.invariants = splitList(value);
+ else if (key == "n_bins") cfg.nBins = atoi(value.c_str());
+ else if (key == "plots") cfg.plots = atoi(value.c_str()) != 0;
+ else if (key == "terms") cfg.terms = parseTerms(value);
+ else if (key == "pid") cfg.pid = atoi(value.c_str());
+ else if (key == "threads") cfg.nThreads = atoi(value.c_str());
+ else if (key == "schedule") {
+  if (value != "static" && value != "dynamic" && value != "guided") {
+   cout << "unknown schedule: " << value << endl;
+   exit(1);
+  }
+  cfg.schedule = value;
+ }
+ else if (key == "grain") cfg.grain = atoi(value.c_str());
+ else if (key == "first_touch") cfg.firstTouch = atoi(value.c_str()) != 0;
+ else if (key == "pin_threads") cfg.pinThreads = atoi(value.c_str()) != 0;
+ else if (key == "kernel") {
+  if (value != "gemm" && value != "direct") {
+   cout << "unknown kernel: " << value << endl;
+   exit(1);
+  }
+  cfg.kernel = value;
+ }
+ else if (key == "tiling") {
+  if (value != "off" && value != "on" && value != "auto") {
+   cout << "unknown tiling: " << value << endl;
+   exit(1);
+  }
+  cfg.tiling = value;
+ }
+ else if (key == "tile_elements") cfg.tileElements = atoi(value.c_str());
+ else if (key == "tile_momenta") cfg.tileMomenta = atoi(value.c_str());
+ else if (key == "surface_cache") cfg.surfaceCache = value;
+ else if (key == "precision") {
+  if (value != "double" && value != "float" && value != "validate") {
+   cout << "unknown precision: " << value << endl;
+   exit(1);
+  }
+  cfg.precision = value;
+ }
+ else if (key == "compensated_sum") cfg.compensatedSum = atoi(value.c_str()) != 0;
+ else if (key == "particle_table") cfg.particleTable = value;
+ else if (key == "decay_table") cfg.decayTable = value;
+ else if (key == "coefficient_file") cfg.coefficientFile = value;
+ else if (key == "interpolation_table") cfg.interpolationTable = value;
+ else if (key == "output_format") {
+  if (value != "auto" && value != "text" && value != "binary") {
+   cout << "unknown output_format: " << value << endl;
+   exit(1);
+  }
+  cfg.outputFormat = value;
+ }
+ else if (key == "restframe") cfg.restFrame = atoi(value.c_str()) != 0;
+ else if (key == "harmonics") cfg.harmonics = atoi(value.c_str());
+ else if (key == "pt_min") cfg.ptMin = atof(value.c_str());
+ else if (key == "pt_max") cfg.ptMax = atof(value.c_str());
+ else if (key == "n_pt") cfg.nPt = atoi(value.c_str());
+ else if (key == "n_phi") cfg.nPhi = atoi(value.c_str());
+ else if (key == "pt_grid") {
+  if (value != "uniform" && value != "legendre" && value != "laguerre") {
+   cout << "unknown pt_grid: " << value << endl;
+   exit(1);
+  }
+  cfg.ptGrid = value;
+ }
+ else if (key == "pt_scale") cfg.ptScale = atof(value.c_str());
+ else if (key == "pt_min_int") cfg.ptMinInt = atof(value.c_str());
+ else if (key == "pt_max_int") cfg.ptMaxInt = atof(value.c_str());
+ else if (key == "tuning_factor") cfg.tuningFactor = atof(value.c_str());
+ else if (key == "kappa_coefficient") cfg.kappaCoefficient = atof(value.c_str());
+ else if (key == "kappa_tuning_factor") cfg.kappaTuningFactor = atof(value.c_str());
+ else if (key == "scan_tuning_factor") cfg.scanTuningFactors = parseNumbers(value);
+ else if (key == "scan_kappa_tuning_factor") cfg.scanKappaTuningFactors = parseNumbers(value);
+ else if (key == "scan_coefficient_file") cfg.scanCoefficientFiles = splitList(value);
+ else if (key == "follow") cfg.follow = atoi(value.c_str()) != 0;
+ else if (key == "follow_end") cfg.followEnd = value;
+ else if (key == "follow_chunk") cfg.followChunk = atoi(value.c_str());
+ else if (key == "follow_interval") cfg.followInterval = atof(value.c_str());
+ else if (key == "follow_timeout") cfg.followTimeout = atof(value.c_str());
+ else if (key == "boost_invariant") cfg.boostInvariant = atoi(value.c_str()) != 0;
+ else if (key == "boost_invariant_deta") cfg.boostInvariantDeta = atof(value.c_str());
+ else if (key == "global_y_bins") cfg.globalYBins = parseNumbers(value);
+ else if (key == "global_n_y") cfg.globalNY = atoi(value.c_str());
+ else if (key == "global_n_pt") cfg.globalNPt = atoi(value.c_str());
+ else if (key == "global_pt_scale") cfg.globalPtScale = atof(value.c_str());
+ else if (key == "global_n_phi") cfg.globalNPhi = atoi(value.c_str());
+ else if (key == "progress_interval") cfg.progressInterval = atof(value.c_str());
+ else if (key == "heartbeat_file") cfg.heartbeatFile = value;
+ else return false;
+ return true;
+}
+
+void readParams(Config &cfg, const char *filename) {
+ ifstream fin(filename);
+ if (!fin) {
+  cout << "cannot read parameter file " << filename << endl;
+  exit(1);
+ }
+ string line;
+ int nline = 0;
+ while (getline(fin, line)) {
+  nline++;
+  const size_t comment = line.find('#');
+  if (comment != string::npos) line.erase(comment);
+  istringstream instream(line);
+  string key, value;
+  if (!(instream >> key)) continue;  // empty line
+  getline(instream >> ws, value);
+  value.erase(value.find_last_not_of(" \t\r") + 1);
+  if (!setParam(cfg, key, value)) {
+   cout << filename << ":" << nline << ": unknown parameter " << key << endl;
+   exit(1);
+  }
+ }
+}
+
+int readCommandLine(Config &cfg, int argc, char **argv, string positional[3]) {
+ int npos = 0;
+ for (int i = 1; i < argc; i++) {
+  if (argv[i][0] == '-' && strlen(argv[i]) > 1 && !isdigit(argv[i][1])) {
+   const string key = argv[i] + 1;
+   // flags without value
+   if (key == "restframe") {
+    cfg.restFrame = true;
+    continue;
+   }
+   if (i + 1 >= argc) {
+    cout << "missing value for " << argv[i] << endl;
+    exit(1);
+   }
+   const string value = argv[++i];
+   if (key == "params")
+    readParams(cfg, value.c_str());
+   else if (!setParam(cfg, key, value)) {
+    cout << "unknown option " << argv[i - 1] << endl;
+    exit(1);
+   }
+  } else if (npos < 3) {
+   positional[npos++] = argv[i];
+  } else {
+   cout << "unexpected argument " << argv[i] << endl;
+   exit(1);
+  }
+ }
+ if (npos == 3) cfg.pid = atoi(positional[2].c_str());
+ return npos;
+}
+
+void printConfig(const Config &cfg) {
+ cout << "mode: " << modeName(cfg.mode) << ", pid: " << cfg.pid << ", terms:";
+ for (int t = 1; t < (1 << nTerms); t <<= 1)
+  if (cfg.terms & t) cout << " " << termName(t);
+ cout << endl;
+ if (cfg.mode == MODE_GLOBAL) {
+  cout << "global: pT " << cfg.ptMinInt << "..." << cfg.ptMaxInt << " (" << cfg.globalNPt
+       << " Laguerre nodes, scale " << cfg.globalPtScale << "), phi (" << cfg.globalNPhi
+       << "), y bins";
+  for (int i = 0; i < cfg.globalYBins.size(); i++) cout << " " << cfg.globalYBins[i];
+  cout << " (" << cfg.globalNY << " Legendre nodes each)" << endl;
+ }
+ cout << "grid: pT " << cfg.ptMin << "..." << cfg.ptMax << " (" << cfg.nPt
+      << (cfg.ptGrid != "uniform" ? " " + cfg.ptGrid : string()) << "), phi (" << cfg.nPhi << "); threads: " << cfg.nThreads
+      << ", schedule: " << cfg.schedule << "," << cfg.grain << endl;
+ cout << "tuning_factor = " << cfg.tuningFactor
+      << ", kappa_coefficient = " << cfg.kappaCoefficient
+      << ", kappa_tuning_factor = " << cfg.kappaTuningFactor << endl;
+ if (isScan(cfg))
+  cout << "scan: " << cfg.scanTuningFactors.size() << " tuning factors, "
+       << cfg.scanKappaTuningFactors.size() << " kappa tuning factors, "
+       << cfg.scanCoefficientFiles.size() << " coefficient tables" << endl;
+}
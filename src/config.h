@@ -0,0 +1,93 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <string>
+#include <vector>
+
+// execution modes
+enum { MODE_POLARIZATION = 0, MODE_INVARIANTS = 1, MODE_GLOBAL = 2 };
+
+// polarization terms, bit flags; the order is also the output order
+enum {
+ TERM_STANDARD = 1,  // thermal vorticity (dmuCart/T), arXiv:1610.04717
+ TERM_XI = 2,        // thermal shear 'xi' term, arXiv:2103.14621
+ TERM_SHEAR = 4,     // Navier-Stokes shear term with the xi_delta(z) coefficient
+ TERM_SPIN0 = 8      // spin potential zero term with kappa_coefficient
+};
+const int nTerms = 4;
+
+// Run time parameters. Every field can be set from a parameter file with
+// "key value" lines (-params <file>) or on the command line as -key value;
+// later settings override earlier ones.
+struct Config {
+ int mode;                    // mode: polarization, invariants or global
+ std::vector<std::string> invariants; // invariants: histograms of mode invariants, or "all"
+ int nBins;                   // n_bins: bins of the invariant histograms
+ bool plots;                  // plots: draw the invariant histograms with ROOT
+ int terms;                   // terms: comma separated list or "all"
+ int pid;                     // pid: PDG code of the particle
+ int nThreads;                // threads: OpenMP threads, 0 = OpenMP default
+ std::string schedule;        // schedule: static, dynamic or guided element loop
+ int grain;                   // grain: elements per chunk of the schedule
+ bool firstTouch;             // first_touch: parallel first touch of the surface
+ bool pinThreads;             // pin_threads: pin OpenMP threads to cpus
+ std::string kernel;          // kernel: gemm or direct evaluation of the terms
+ std::string tiling;          // tiling: off, on or auto blocking of the element loop
+ int tileElements, tileMomenta; // tile_elements, tile_momenta: tile size for tiling on
+ std::string surfaceCache;    // surface_cache: directory of the preprocessed surfaces, "" = none
+ std::string precision;       // precision: double, float or validate (both, compared) surface
+ bool compensatedSum;         // compensated_sum: Kahan summation of the gemm accumulators
+ std::string particleTable;   // particle_table
+ std::string decayTable;      // decay_table
+ std::string coefficientFile; // coefficient_file: xi_delta(z) csv table
+ std::string interpolationTable; // interpolation_table: dump of the spline, "" = none
+ std::string outputFormat;    // output_format: auto (.bin -> binary), text, binary
+ bool restFrame;              // restframe: rest frame P* and integrated observables
+ int harmonics;               // harmonics: output the phi moments n = 0...harmonics, 0 = the grid
+ double ptMin, ptMax;         // pt_min, pt_max: momentum grid [GeV]
+ int nPt, nPhi;               // n_pt, n_phi: grid points, phi in [0, 2pi)
+ std::string ptGrid;          // pt_grid: uniform, legendre or laguerre pT nodes
+ double ptScale;              // pt_scale: laguerre pT = pt_min + pt_scale*node [GeV]
+ double ptMinInt, ptMaxInt;   // pt_min_int, pt_max_int: range of integrated P
+ double tuningFactor;         // tuning_factor: scales xi_delta(z)
+ double kappaCoefficient;     // kappa_coefficient
+ double kappaTuningFactor;    // kappa_tuning_factor
+ // scan_tuning_factor, scan_kappa_tuning_factor, scan_coefficient_file:
+ // comma separated lists; if any is set, the output is written for every
+ // combination, see gen::doScanCalculations
+ std::vector<double> scanTuningFactors, scanKappaTuningFactors;
+ std::vector<std::string> scanCoefficientFiles;
+ // follow: process the surface while it is written, see gen::doFollowCalculations
+ bool follow;
+ std::string followEnd;       // follow_end: line which ends the surface
+ int followChunk;             // follow_chunk: maximal elements per chunk
+ double followInterval;       // follow_interval: seconds between polls of the file
+ double followTimeout;        // follow_timeout: end after seconds without new lines, 0 = never
+ // boost_invariant: integrate the eta slice closest to 0 over eta analytically,
+ // see gen::selectEtaSlice
+ bool boostInvariant;
+ double boostInvariantDeta;   // boost_invariant_deta: eta width in dsigma, 0 = from the surface
+ // mode global: momentum-integrated polarization, see gen::outputGlobal
+ std::vector<double> globalYBins; // global_y_bins: edges of the rapidity bins
+ int globalNY;                // global_n_y: Gauss-Legendre nodes per rapidity bin
+ int globalNPt;               // global_n_pt: Gauss-Laguerre nodes in pT from pt_min_int
+ double globalPtScale;        // global_pt_scale: pT scale of the Laguerre nodes [GeV]
+ int globalNPhi;              // global_n_phi: uniform nodes in phi
+ double progressInterval;     // progress_interval: seconds between reports, 0 = none
+ std::string heartbeatFile;   // heartbeat_file: JSON progress file, "" = none
+ Config();
+};
+
+extern Config config;
+
+bool setParam(Config &cfg, const std::string &key, const std::string &value);
+void readParams(Config &cfg, const char *filename);
+// parses "<surface> <output> [PID] [-key value ...]"; returns the number of
+// positional arguments found
+int readCommandLine(Config &cfg, int argc, char **argv, std::string positional[3]);
+void printConfig(const Config &cfg);
+const char *termName(int term);
+const char *modeName(int mode);
+bool isScan(const Config &cfg);
+
+#endif // CONFIG_H
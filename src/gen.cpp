@@ -1,27 +1,36 @@
 #include <omp.h>
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+#ifndef HEADLESS
 #include <TCanvas.h>
-#include <TGraph.h>
-#include <TMath.h>
-#include <TVector3.h>
-#include <TLorentzVector.h>
-#include <TRandom3.h>
+#include <TH1D.h>
+#endif
+#include <algorithm>
 #include <cmath>
 #include <iomanip>
 #include <cstdlib>
+#include <cstring>
 #include <cmath>
 #include <iostream>
 #include <fstream>
 #include <sstream>
-#include <TF1.h>
-#include <TH1D.h>
-#include <TSpline.h>
-#include <TGraph.h>
+#include <ctime>
+#include <chrono>
+#include <thread>
+#include <type_traits>
+#include <sys/stat.h>
 
 #include "DatabasePDG2.h"
 #include "gen.h"
 #include "particle.h"
 #include "const.h"
 #include "interpolation.h"
+#include "config.h"
+#include "progress.h"
+#include "histogram.h"
+#include "compression.h"
+#include "quadrature.h"
 
 using namespace std;
 
@@ -38,6 +47,8 @@ int levi(int i, int j, int k, int l)
 
 namespace gen {
 
+void setElementSchedule(int chunkSize = 1);
+
 int Nelem;
 double *ntherm, dvMax, dsigmaMax;
 TRandom3 *rnd;
@@ -47,45 +58,158 @@ int NPART;
 
 
 
+// The tensors are only loaded if the mode and the terms need them (see
+// surfaceFields); they are stored in separate arrays, and the pointers are 0
+// for the ones not loaded.
 struct element {
  double tau, x, y, eta;
  double u[4];
  double dsigma[4];
  double T, mub, muq, mus;
- double dbeta [4][4];
- double dmuCart [4][4]; //derivatives of the 4-velocity in Cartesian coordinates
+ double (*dbeta)[4];
+ double (*dmuCart)[4]; //derivatives of the 4-velocity in Cartesian coordinates
+ double dbeta00;       // dbeta[0][0], always loaded for ELEM_BAD_DBETA
+ // derived quantities, set by preprocessElements and kept in the cache
+ double invT;          // 1/T
+ double dsu;           // dsigma_mu u^mu
+ double (*sigma)[4];   // shear tensor, see shear_tensor
+ int flags;            // ELEM_ flags
+};
+
+// optional element fields, bit flags
+enum {
+ FIELD_DBETA = 1,      // dbeta
+ FIELD_DMUCART = 2,    // dmuCart
+ FIELD_SIGMA = 4       // sigma, needs dmuCart
+};
+const int nFields = 3;
+
+// element flags
+enum {
+ ELEM_BAD_DBETA = 1,   // |dbeta[0][0]| > 1000
+ ELEM_NEGATIVE_DSU = 2 // dsigma_mu u^mu < 0
+};
+
+// version of the surface cache; increase it when element or
+// preprocessElements changes
+const unsigned int surfaceCacheVersion = 2;
+
+// Single precision copy of the element fields used by the polarization
+// kernels (precision float), 184 bytes per element against 312 (440 with
+// the shear term) for element with its dmuCart and sigma arrays. The
+// derived quantities are computed in double before the conversion, and the
+// kernels compute and accumulate in double.
+struct elementF {
+ float u[4];
+ float dsigma[4];
+ float T, mub, muq, mus;
+ float dmuCart[4][4];
+ float invT;
+ float sigma[4][4];
+ int flags;
 };
 
 element *surf;
+elementF *surfF = 0;
+int surfFields;           // FIELD_ flags of surf
+double *fieldData[nFields]; // the loaded fields, [n*16 + mu*4 + nu]
 vector<double> pT, phi;
-vector<vector<vector<double> > > Pi_num; // numerator of Eq. 34
-vector<vector<vector<double> > > Pi_num_navierstokes; // David's contributions
-vector<vector<vector<double> > > Pi_num_spin_potential_zero;
-vector<vector<vector<double> > > Pi_num_xi; // additional "xi" term
-vector<vector<double> > Pi_den; // denominator of Eq. 34
+// quadrature weights of the integrals over pT and phi at the nodes pT, phi
+// (without the pT of d^2pT = pT dpT dphi), see ptNodes
+vector<double> wPt, wPhi;
+int nMom; // number of (pT,phi) points, index ip = ipt*phi.size() + iphi
+vector<double> pGrid; // 4-momenta p^mu at the grid points, [ip*4 + mu]
+// mode global: pT and phi are quadrature nodes, repeated for the rapidity
+// nodes yNode, ip = (iy*pT.size() + ipt)*phi.size() + iphi. quadWeight[ip]
+// is the weight of the integral over d^3p/E = pT dpT dphi dy, yBin[iy] the
+// rapidity bin of the node
+vector<double> yNode, quadWeight;
+vector<int> yBin;
+// numerators of Eq. 34 for the polarization terms, in the order of the TERM_
+// flags: standard, additional "xi" term, David's Navier-Stokes shear
+// contribution, spin potential zero; [ip*4 + mu]
+vector<double> Pi_num[nTerms];
+vector<double> Pi_den; // denominator of Eq. 34, [ip]
 int nhydros;
-TCanvas *plotSymm, *plotAsymm, *plotMod;
-TH1D *histMod, *histSymm, *histAsymm;
+string surfaceName; // kept for the provenance record of the binary output
+// component names in the output
+const char *termLabel[nTerms] = {"s", "s_xi", "s_shear", "s_spin0"};
+const int nHarmonics = 4; // harmonics n=0..nHarmonics of P_z(phi) and P_J(phi)
+// rest frame polarization P* at each (pT,phi): x,y,z for each enabled term
+// and for the total
+int nPstar = 0;
+vector<double> Pstar;
 
 // Hendrik says that this is a known factor oftenly appearing in distribution functions.
 // As example look in SMASH pauli blocking or go an Hendrik's nerves with it
 // Found in longer David paper eq. 20
-const double c1 = pow(1. / 2. / hbarC / TMath::Pi(), 3.0);
+const double c1 = pow(1. / 2. / hbarC / M_PI, 3.0);
+
+// sets the field pointers of the elements to the field arrays
+void linkFields() {
+ for (int n = 0; n < Nelem; n++) {
+  double (*f[nFields])[4];
+  for (int i = 0; i < nFields; i++)
+   f[i] = fieldData[i] ? (double (*)[4]) &fieldData[i][n * 16] : 0;
+  surf[n].dbeta = f[0];
+  surf[n].dmuCart = f[1];
+  surf[n].sigma = f[2];
+ }
+}
 
-// ######## load the elements
-void load(char *filename, int N) {
- double dV, vEff = 0.0, vEffOld = 0.0, dvEff, dvEffOld;
- int nfail = 0, ncut = 0;
- TLorentzVector dsigma;
+// allocates the surface for N elements with the FIELD_ flags 'fields'
+void allocateSurface(int N, int fields) {
  Nelem = N;
+ surfFields = fields;
  surf = new element[Nelem];
+ for (int i = 0; i < nFields; i++)
+  fieldData[i] = (fields & (1 << i)) ? new double[(size_t)Nelem * 16] : 0;
+ // The pages of surf are placed on the NUMA node of the thread which writes
+ // them first. Touch them in parallel with the element loop schedule, so that
+ // with the static schedule every thread reads its elements from local
+ // memory; with the dynamic ones the surface is at least spread evenly over
+ // the nodes instead of all landing on the node of the reading thread.
+ if (config.firstTouch) {
+  setElementSchedule();
+  #pragma omp parallel for schedule(runtime)
+  for (int n = 0; n < Nelem; n++) {
+   memset(&surf[n], 0, sizeof(element));
+   for (int i = 0; i < nFields; i++)
+    if (fieldData[i]) memset(&fieldData[i][n * 16], 0, 16 * sizeof(double));
+  }
+ }
+ linkFields();
+}
 
- cout << "reading " << N << " lines from  " << filename << "\n";
- ifstream fin(filename);
- if (!fin) {
-  cout << "cannot read file " << filename << endl;
-  exit(1);
+void freeSurface() {
+ delete[] surf;
+ surf = 0;
+ for (int i = 0; i < nFields; i++) {
+  delete[] fieldData[i];
+  fieldData[i] = 0;
+ }
+}
+
+// skips n columns of the current line; fails if the line has fewer
+void skipColumns(istream &in, int n) {
+ streambuf *sb = in.rdbuf();
+ const int eof = istream::traits_type::eof();
+ for (int i = 0; i < n; i++) {
+  int ch = sb->sgetc();
+  while (ch == ' ' || ch == '\t') ch = sb->snextc();
+  if (ch == eof || ch == '\r' || ch == '\n') {
+   in.setstate(ios::failbit);
+   return;
+  }
+  while (ch != eof && ch != ' ' && ch != '\t' && ch != '\r' && ch != '\n')
+   ch = sb->snextc();
  }
+}
+
+// reads Nelem elements, one per line, from the current position of fin
+void readElements(istream &fin) {
+ double dV, vEff = 0.0, dvEff;
+ int ncut = 0;
  dvMax = 0.;
  dsigmaMax = 0.;
  // ---- reading loop
@@ -100,30 +224,28 @@ void load(char *filename, int N) {
       surf[n].dsigma[0] >> surf[n].dsigma[1] >> surf[n].dsigma[2] >>
       surf[n].dsigma[3] >> surf[n].u[0] >> surf[n].u[1] >> surf[n].u[2] >>
       surf[n].u[3] >> surf[n].T >> surf[n].mub >> surf[n].muq >> surf[n].mus;
-  for(int i=0; i<4; i++)
-  for(int j=0; j<4; j++)
-   //dbeta is the thermal vorticity 
-   instream >> surf[n].dbeta[i][j];
+  // the columns of the fields which are not needed are skipped unparsed
+  instream >> surf[n].dbeta00;
+  if (surf[n].dbeta) {
+   surf[n].dbeta[0][0] = surf[n].dbeta00;
+   for(int j=1; j<16; j++)
+    //dbeta is the thermal vorticity 
+    instream >> surf[n].dbeta[j / 4][j % 4];
+  } else
+   skipColumns(instream, 15);
 
-  for(int i=0; i<4; i++)
-  for(int j=0; j<4; j++)
-   instream >> surf[n].dmuCart[i][j];
+  if (surf[n].dmuCart) {
+   for(int i=0; i<4; i++)
+   for(int j=0; j<4; j++)
+    instream >> surf[n].dmuCart[i][j];
+  } else
+   skipColumns(instream, 16);
 
   if (instream.fail()) {
    cout << "reading failed at line " << n << "; exiting\n";
    exit(1);
   }
-  // calculate in the old way
-  dvEffOld =
-      surf[n].dsigma[0] * surf[n].u[0] + surf[n].dsigma[1] * surf[n].u[1] +
-      surf[n].dsigma[2] * surf[n].u[2] + surf[n].dsigma[3] * surf[n].u[3];
-  vEffOld += dvEffOld;
-  if (dvEffOld < 0.0) {
-   // cout<<"!!! dvOld!=dV " << dvEffOld <<"  " << dV << "  " << surf[n].tau
-   // <<endl ;
-   nfail++;
-  }
-  // if(nfail==100) exit(1) ;
+  // dsigma.u "in the old way" is computed in preprocessElements
   // ---- boost
   // dsigma.SetXYZT(-surf[n].dsigma[1],-surf[n].dsigma[2],-surf[n].dsigma[3],surf[n].dsigma[0])
   // ;
@@ -154,47 +276,366 @@ void load(char *filename, int N) {
  // cout<<"dsigmaMax="<<dsigmaMax<<endl ;
 }
 
+double shear_tensor(const element* surf_element, int mu, int nu);
+
+// computes the derived quantities of all elements
+void preprocessElements() {
+ #pragma omp parallel for schedule(runtime)
+ for (int n = 0; n < Nelem; n++) {
+  element &el = surf[n];
+  el.invT = 1. / el.T;
+  // calculate in the old way
+  el.dsu = el.dsigma[0] * el.u[0] + el.dsigma[1] * el.u[1] +
+           el.dsigma[2] * el.u[2] + el.dsigma[3] * el.u[3];
+  if (el.sigma)
+   for (int mu = 0; mu < 4; mu++)
+    for (int nu = 0; nu < 4; nu++) el.sigma[mu][nu] = shear_tensor(&el, mu, nu);
+  el.flags = 0;
+  if (fabs(el.dbeta00) > 1000.0) el.flags |= ELEM_BAD_DBETA;
+  if (el.dsu < 0.0) el.flags |= ELEM_NEGATIVE_DSU;
+ }
+}
+
+// FNV-1a hash of the bytes [first, end) of fin, of the first line (for the
+// slices of compressed files) and of the cache version
+unsigned long long hashRange(istream &fin, long long first, long long end,
+                             long long firstLine) {
+ unsigned long long h = 14695981039346656037ULL;
+ const unsigned long long prime = 1099511628211ULL;
+ for (int i = 0; i < 4; i++) {
+  h ^= (surfaceCacheVersion >> (8 * i)) & 0xff;
+  h *= prime;
+ }
+ for (int i = 0; i < 8; i++) {
+  h ^= (firstLine >> (8 * i)) & 0xff;
+  h *= prime;
+ }
+ vector<char> buf(1 << 20);
+ fin.clear();
+ fin.seekg(first);
+ for (long long pos = first; pos < end;) {
+  const long long n = min((long long)buf.size(), end - pos);
+  fin.read(&buf[0], n);
+  if (fin.gcount() != n) break;
+  for (long long i = 0; i < n; i++) {
+   h ^= (unsigned char)buf[i];
+   h *= prime;
+  }
+  pos += n;
+ }
+ return h;
+}
+
+// The surface cache is a binary file with the parsed and preprocessed
+// elements: "PCALCSRF", uint32 version, uint32 sizeof(element), uint32
+// FIELD_ flags, uint64 hash, int64 number of elements, then the element
+// array (with invalid field pointers) and the arrays of the loaded fields.
+bool readSurfaceCache(const string &file, unsigned long long hash, int N,
+                      int fields) {
+ ifstream fin(file.c_str(), ios::in | ios::binary);
+ if (!fin) return false;
+ char magic[8];
+ unsigned int version = 0, size = 0, f = 0;
+ unsigned long long h = 0;
+ long long n = 0;
+ fin.read(magic, 8);
+ fin.read((char *)&version, sizeof(version));
+ fin.read((char *)&size, sizeof(size));
+ fin.read((char *)&f, sizeof(f));
+ fin.read((char *)&h, sizeof(h));
+ fin.read((char *)&n, sizeof(n));
+ if (!fin || memcmp(magic, "PCALCSRF", 8) != 0 || version != surfaceCacheVersion
+     || size != sizeof(element) || f != fields || h != hash || n != N) {
+  cout << "surface cache " << file << " does not match, ignored" << endl;
+  return false;
+ }
+ allocateSurface(N, fields);
+ fin.read((char *)surf, (streamsize)N * sizeof(element));
+ for (int i = 0; i < nFields; i++)
+  if (fieldData[i]) fin.read((char *)fieldData[i], (streamsize)N * 16 * sizeof(double));
+ if (!fin) {
+  cout << "surface cache " << file << " is truncated, ignored" << endl;
+  freeSurface();
+  return false;
+ }
+ linkFields();
+ return true;
+}
+
+void writeSurfaceCache(const string &file, unsigned long long hash) {
+ // written to a temporary file and renamed, so that a concurrent run never
+ // reads a partial cache
+ const string tmp = file + ".tmp";
+ ofstream fout(tmp.c_str(), ios::out | ios::binary);
+ const unsigned int version = surfaceCacheVersion, size = sizeof(element),
+   fields = surfFields;
+ const long long n = Nelem;
+ fout.write("PCALCSRF", 8);
+ fout.write((const char *)&version, sizeof(version));
+ fout.write((const char *)&size, sizeof(size));
+ fout.write((const char *)&fields, sizeof(fields));
+ fout.write((const char *)&hash, sizeof(hash));
+ fout.write((const char *)&n, sizeof(n));
+ fout.write((const char *)surf, (streamsize)Nelem * sizeof(element));
+ for (int i = 0; i < nFields; i++)
+  if (fieldData[i])
+   fout.write((const char *)fieldData[i], (streamsize)Nelem * 16 * sizeof(double));
+ fout.close();
+ if (!fout || rename(tmp.c_str(), file.c_str()) != 0) {
+  cout << "cannot write surface cache " << file << endl;
+  remove(tmp.c_str());
+  return;
+ }
+ cout << "surface cache written: " << file << endl;
+}
+
+// Reads the N elements in the bytes [first, end) of fin, with the FIELD_
+// flags 'fields', and preprocesses them. A compressed file is decompressed
+// while it is parsed, and the elements start at line firstLine of the
+// decompressed text (first and end are the whole file then). With a
+// surface_cache directory, the elements are taken from
+// <dir>/<hash>_<fields>.surf if it exists, where hash is the content hash of
+// these bytes, so the cache is shared by all runs on the same surface
+// (species, parameters, output) whatever the file is called.
+void readSurface(const char *filename, ifstream &fin, long long first,
+                 long long end, long long firstLine, int N, int fields) {
+ string cacheFile;
+ unsigned long long hash = 0;
+ if (!config.surfaceCache.empty()) {
+  hash = hashRange(fin, first, end, firstLine);
+  ostringstream name;
+  name << config.surfaceCache << "/" << hex << setw(16) << setfill('0') << hash
+       << "_" << dec << fields << ".surf";
+  cacheFile = name.str();
+  if (readSurfaceCache(cacheFile, hash, N, fields)) {
+   cout << "surface read from cache " << cacheFile << endl;
+   return;
+  }
+ }
+ allocateSurface(N, fields);
+ const int format = detectCompression(filename);
+ if (format == COMPRESSION_NONE) {
+  fin.clear();
+  fin.seekg(first);
+  readElements(fin);
+ } else {
+  DecompressStream text(filename, format, omp_get_max_threads());
+  string line;
+  for (long long i = 0; i < firstLine; i++) getline(text, line);
+  readElements(text);
+ }
+ preprocessElements();
+ if (!cacheFile.empty()) writeSurfaceCache(cacheFile, hash);
+}
+
+// boost_invariant: keeps the elements of the eta slice closest to eta = 0.
+// If boost_invariant_deta is 0 it is set to the spacing of the eta slices.
+void selectEtaSlice() {
+ const double tolerance = 1e-6;
+ vector<double> etas;
+ for (int n = 0; n < Nelem; n++) etas.push_back(surf[n].eta);
+ sort(etas.begin(), etas.end());
+ vector<double> slices;
+ for (int i = 0; i < etas.size(); i++)
+  if (slices.empty() || etas[i] - slices.back() > tolerance) slices.push_back(etas[i]);
+ if (slices.empty()) return;
+ double eta0 = slices[0];
+ for (int i = 1; i < slices.size(); i++)
+  if (fabs(slices[i]) < fabs(eta0)) eta0 = slices[i];
+ if (config.boostInvariantDeta <= 0.) {
+  if (slices.size() < 2) {
+   cout << "boost_invariant: the surface has one eta slice, set boost_invariant_deta" << endl;
+   exit(1);
+  }
+  double deta = slices[1] - slices[0];
+  for (int i = 2; i < slices.size(); i++) deta = min(deta, slices[i] - slices[i - 1]);
+  config.boostInvariantDeta = deta;
+ }
+ int n = 0;
+ for (int i = 0; i < Nelem; i++) {
+  if (fabs(surf[i].eta - eta0) > tolerance) continue;
+  if (n != i) {
+   surf[n] = surf[i];
+   for (int f = 0; f < nFields; f++)
+    if (fieldData[f])
+     memcpy(&fieldData[f][n * 16], &fieldData[f][i * 16], 16 * sizeof(double));
+  }
+  n++;
+ }
+ cout << "boost_invariant: " << n << " of " << Nelem << " elements in the slice eta = "
+      << eta0 << " (" << slices.size() << " slices), deta = " << config.boostInvariantDeta
+      << endl;
+ Nelem = n;
+ linkFields();
+}
+
+// ######## load the elements, with the FIELD_ flags 'fields', see surfaceFields;
+// the file may be gzip or zstd compressed
+void load(char *filename, int N, int fields) {
+ surfaceName = filename;
+ const int format = detectCompression(filename);
+ cout << "reading " << N << " lines from  " << filename
+      << (format != COMPRESSION_NONE ? string(" (") + compressionName(format) + ")" : "")
+      << "\n";
+ ifstream fin(filename, ios::in | ios::binary);
+ if (!fin) {
+  cout << "cannot read file " << filename << endl;
+  exit(1);
+ }
+ fin.seekg(0, ios::end);
+ const long long size = fin.tellg();
+ readSurface(filename, fin, 0, size, 0, N, fields);
+}
+
+// Loads the part of the surface for one of nSlices processes: the file is cut
+// into nSlices equal byte ranges, and slice i gets the lines which start in
+// the i-th range. Only this part of the file is read. A compressed file
+// cannot be cut, there every process decompresses the file up to its slice,
+// which is the i-th of nSlices equal ranges of lines.
+void loadSlice(char *filename, int slice, int nSlices, int fields) {
+ ifstream fin(filename, ios::in | ios::binary);
+ if (!fin) {
+  cout << "cannot read file " << filename << endl;
+  exit(1);
+ }
+ fin.seekg(0, ios::end);
+ const long long size = fin.tellg();
+ const int format = detectCompression(filename);
+ if (format != COMPRESSION_NONE) {
+  const long long nLines = countLines(filename);
+  const long long firstLine = nLines * slice / nSlices;
+  const int N = nLines * (slice + 1) / nSlices - firstLine;
+  surfaceName = filename;
+  cout << "reading " << N << " lines (from line " << firstLine << ") of slice "
+       << slice << "/" << nSlices << " from  " << filename << " ("
+       << compressionName(format) << ")\n";
+  readSurface(filename, fin, 0, size, firstLine, N, fields);
+  return;
+ }
+ const long long begin = size * slice / nSlices;
+ const long long end = size * (slice + 1) / nSlices;
+ // skip the line which started in the previous range
+ long long first = begin;
+ string line;
+ fin.seekg(0);
+ if (begin > 0) {
+  fin.seekg(begin - 1);
+  getline(fin, line);
+  first = begin + (long long)line.size();
+ }
+ // count the lines starting in [first, end)
+ int N = 0;
+ long long last = first;
+ for (; last < end && getline(fin, line); N++)
+  last += line.size() + 1;
+ surfaceName = filename;
+ cout << "reading " << N << " lines (bytes " << first << "...) of slice "
+      << slice << "/" << nSlices << " from  " << filename << "\n";
+ readSurface(filename, fin, first, min(last, size), 0, N, fields);
+}
+
+// pT nodes pt and weights w for integrals over pT: uniform grid ptMin...ptMax
+// (weights: the step, the rectangle rule of the integrated output),
+// Gauss-Legendre on [ptMin, ptMax] or Gauss-Laguerre from ptMin with
+// pT = ptMin + scale*x, where the nodes above ptMax are dropped
+void ptNodes(const string &kind, int n, double ptMin, double ptMax, double scale,
+             vector<double> &pt, vector<double> &w) {
+ pt.clear();
+ w.clear();
+ if (kind == "uniform") {
+  for (int ipt = 0; ipt < n; ipt++) {
+   pt.push_back(n > 1 ? ptMin + (ptMax - ptMin) * ipt / (n - 1) : ptMin);
+   w.push_back(n > 1 ? (ptMax - ptMin) / (n - 1) : 1.);
+  }
+ } else if (kind == "legendre")
+  gaussLegendre(n, ptMin, ptMax, pt, w);
+ else {
+  if (scale <= 0.) {
+   cout << "the laguerre pT nodes need a positive scale" << endl;
+   exit(1);
+  }
+  vector<double> x, wx;
+  gaussLaguerre(n, x, wx);
+  for (int i = 0; i < x.size(); i++) {
+   if (ptMin + scale * x[i] > ptMax) continue;
+   pt.push_back(ptMin + scale * x[i]);
+   w.push_back(scale * wx[i] * exp(x[i]));
+  }
+ }
+}
+
+// Quadrature nodes of mode global: Gauss-Laguerre in pT from pt_min_int
+// (pT = pt_min_int + global_pt_scale*x, the nodes above pt_max_int are
+// dropped), uniform in phi (trapezoidal rule, exact for the harmonics below
+// global_n_phi) and Gauss-Legendre in each rapidity bin
+void initGlobalGrid() {
+ const vector<double> &edges = config.globalYBins;
+ if (edges.size() < 2 || config.globalNY < 1 || config.globalNPt < 1
+     || config.globalNPhi < 1 || config.globalPtScale <= 0.) {
+  cout << "mode global needs at least two global_y_bins edges and positive"
+       << " global_n_y, global_n_pt, global_n_phi, global_pt_scale" << endl;
+  exit(1);
+ }
+ ptNodes("laguerre", config.globalNPt, config.ptMinInt, config.ptMaxInt,
+         config.globalPtScale, pT, wPt);
+ for (int iphi = 0; iphi < config.globalNPhi; iphi++) {
+  phi.push_back(2.0 * M_PI * iphi / config.globalNPhi);
+  wPhi.push_back(2.0 * M_PI / config.globalNPhi);
+ }
+ vector<double> x, w, wY;
+ for (int ib = 0; ib + 1 < edges.size(); ib++) {
+  if (edges[ib + 1] <= edges[ib]) {
+   cout << "global_y_bins must be increasing" << endl;
+   exit(1);
+  }
+  gaussLegendre(config.globalNY, edges[ib], edges[ib + 1], x, w);
+  for (int i = 0; i < x.size(); i++) {
+   yNode.push_back(x[i]);
+   wY.push_back(w[i]);
+   yBin.push_back(ib);
+  }
+ }
+ for (int iy = 0; iy < yNode.size(); iy++)
+  for (int ipt = 0; ipt < pT.size(); ipt++)
+   for (int iphi = 0; iphi < phi.size(); iphi++)
+    quadWeight.push_back(wY[iy] * wPt[ipt] * pT[ipt] * wPhi[iphi]);
+}
+
 void initCalc() {
- for (double _pT = 0.0; _pT < 3.01; _pT += 0.2) {
-  pT.push_back(_pT);
- }
- for (double _phi = 0.0; _phi < 2.0*M_PI-1e-5; _phi += M_PI/20) {
-  phi.push_back(_phi);
- }
- Pi_num.resize(pT.size());
- Pi_num_navierstokes.resize(pT.size());
- Pi_num_spin_potential_zero.resize(pT.size());
- Pi_num_xi.resize(pT.size());
- Pi_den.resize(pT.size());
- for (int i = 0; i < Pi_num.size(); i++) {
-  Pi_num[i].resize(phi.size());
-  Pi_num_navierstokes[i].resize(phi.size());
-  Pi_num_spin_potential_zero[i].resize(phi.size());
-  Pi_num_xi[i].resize(phi.size());
-  Pi_den[i].resize(phi.size());
-  for (int j = 0; j < Pi_num[i].size(); j++) {
-   Pi_den[i][j] = 0.0;
-   Pi_num[i][j].resize(4);
-   Pi_num_navierstokes[i][j].resize(4);
-   Pi_num_spin_potential_zero[i][j].resize(4);
-   Pi_num_xi[i][j].resize(4);
-   for(int k=0; k<4; k++) {
-    Pi_num[i][j][k] = 0.0;
-    Pi_num_navierstokes[i][j][k] = 0.0;
-    Pi_num_spin_potential_zero[i][j][k] = 0.0;
-    Pi_num_xi[i][j][k] = 0.0;
-   }
+ pT.clear();
+ phi.clear();
+ wPhi.clear();
+ yNode.clear();
+ yBin.clear();
+ quadWeight.clear();
+ if (config.mode == MODE_GLOBAL)
+  initGlobalGrid();
+ else {
+  ptNodes(config.ptGrid, config.nPt, config.ptMin, config.ptMax, config.ptScale, pT, wPt);
+  // uniform in phi: the trapezoidal rule is the optimal one for periodic functions
+  for (int iphi = 0; iphi < config.nPhi; iphi++) {
+   phi.push_back(2.0 * M_PI * iphi / config.nPhi);
+   wPhi.push_back(2.0 * M_PI / config.nPhi);
   }
+  if (config.harmonics < 0 || 2 * config.harmonics >= config.nPhi) {
+   cout << "harmonics " << config.harmonics << " needs n_phi > " << 2 * config.harmonics << endl;
+   exit(1);
+  }
+ }
+ const int nY = max((int)yNode.size(), 1);
+ nMom = nY * pT.size() * phi.size();
+ pGrid.resize(nMom * 4);
+ for (int ip = 0; ip < nMom; ip++) {
+  const int ipt = ip / phi.size() % pT.size(), iphi = ip % phi.size();
+  double *p = &pGrid[ip * 4];
+  p[0] = 0.0;  // energy, set in doCalculations once the mass is known
+  p[1] = pT[ipt] * cos(phi[iphi]);
+  p[2] = pT[ipt] * sin(phi[iphi]);
+  p[3] = 0.0;  // mode global: set with the energy
  }
+ Pi_den.assign(nMom, 0.0);
+ for (int it = 0; it < nTerms; it++) Pi_num[it].assign(nMom * 4, 0.0);
  nhydros = 0;
- #ifdef PLOTS
- plotSymm = new TCanvas("plotSymm","symmetric derivatives");
- plotAsymm = new TCanvas("plotAsymm","Asymmetric derivatives");
- plotMod = new TCanvas("plotMod","Derivatives");
- histSymm = new TH1D("histSymm", "histSymm", 100, 0., 5.0);
- histAsymm = new TH1D("histAsymm", "histAsymm", 100, -1.2, 0.2);
- histMod = new TH1D("histMod", "histMod", 100, 0., 2.0);
- #endif
 }
 
 double ffthermal(double *x, double *par) {
@@ -228,214 +669,1426 @@ double shear_tensor(const element* surf_element, int mu, int nu){
 }
 
 
-void doCalculations(int pid) {
- const double tvect[4] = {1.,0., 0., 0.};
+// Per element coefficients of the polarization terms. Each term is the
+// original epsilon-tensor expression with the element-only factors contracted
+// once per element, so that only the momentum dependence is left for the
+// loop over the momentum grid (p_ is the covariant momentum):
+//  standard: Pi^mu += pds*nf * A[mu][sg] p_[sg]
+//  xi:       Pi^mu += pds*nf*(1-nf) * X[mu][sg][ta] p_[sg] p[ta]/p[0]
+//  shear:    Pi^mu += pds*nf * B[mu][rh][ta] p_[rh] p_[ta]
+//  spin0:    Pi^mu += pds*nf * kappa * (4 D[mu] - u[mu]/E_p * D[bet] p_[bet])
+// The element data needed in the momentum loop (u, dsigma, T, mutot) are
+// copied along, so a tile of elements is one compact array.
+struct elementTerms {
+ double A[4][4];
+ double X[4][4][4];
+ double B[4][4][4];
+ double D[4];
+ double u[4], dsigma[4];
+ double T, mutot;
+};
+
+// particle and coefficient data shared by all elements
+struct kernelParams {
+ double mass, baryonCharge, electricCharge, strangeness;
+ const CubicSpline *spline;
+ double tuningFactor, kappaCoefficient;
+};
+
+// thread-local sums over the elements
+struct kernelSums {
+ vector<double> den, num[nTerms];
+ vector<double> acc; // gemm kernel: [ip*nCoef + j], see gemmLayout
+ // compensated_sum: the lost low order parts of den and acc, see kahanAdd
+ vector<double> denC, accC;
+ double Qx1, Qy1, Qx2, Qy2;
+ int nFermiFail, nBadElem, nZout;
+ int nSeriesCut;  // boost_invariant: element*momenta with a cut Fermi series
+ double zMin, zMax;
+ kernelSums() : Qx1(0.), Qy1(0.), Qx2(0.), Qy2(0.), nFermiFail(0),
+   nBadElem(0), nZout(0), nSeriesCut(0), zMin(1e100), zMax(-1e100) {}
+};
+
+// Compensated (Kahan) summation: adds x to sum, c keeps the rounding error
+// of the previous additions. Must not be compiled with -ffast-math.
+inline void kahanAdd(double &sum, double &c, double x) {
+ const double y = x - c;
+ const double t = sum + y;
+ c = (t - sum) - y;
+ sum = t;
+}
+
+template <int TERMS, class E>
+inline void prepareElement(const E &el, const kernelParams &par,
+                           elementTerms &c) {
+ const double u_[4] = {el.u[0], -el.u[1], -el.u[2], -el.u[3]};
+ const double beta = el.invT;
+ const double z = beta * par.mass;
+ for (int mu = 0; mu < 4; mu++) {
+  c.u[mu] = el.u[mu];
+  c.dsigma[mu] = el.dsigma[mu];
+ }
+ c.T = el.T;
+ c.mutot = el.mub * par.baryonCharge + el.muq * par.electricCharge
+   + el.mus * par.strangeness;
+ if (TERMS & TERM_STANDARD) {
+  for (int mu = 0; mu < 4; mu++)
+   for (int sg = 0; sg < 4; sg++) {
+    c.A[mu][sg] = 0.;
+    for (int nu = 0; nu < 4; nu++)
+     for (int rh = 0; rh < 4; rh++)
+      c.A[mu][sg] += levi(mu, nu, rh, sg) * el.dmuCart[nu][rh] * beta;
+   }
+ }
+ if (TERMS & TERM_XI) {
+  // Check out on isothermal branch of vhlle. Here, I use my dmuCart/T as an updated version
+  // instead of dbeta as it is equivalent to the thermal vorticity in the case of the isothermal branch
+  // tvect = (1,0,0,0) selects nu = 0
+  for (int mu = 0; mu < 4; mu++)
+   for (int sg = 0; sg < 4; sg++)
+    for (int ta = 0; ta < 4; ta++) {
+     c.X[mu][sg][ta] = 0.;
+     for (int rh = 0; rh < 4; rh++)
+      c.X[mu][sg][ta] += levi(mu, 0, rh, sg)
+        * (el.dmuCart[rh][ta] * beta + el.dmuCart[ta][rh] * beta);
+    }
+ }
+ if (TERMS & TERM_SHEAR) {
+  // David's formula with extra gmunu because I have shear tensor with upper indices (Euclidean) only.
+  // The tuning factor is non-physical and is just to test how large the
+  // xi_delta_coefficient must be in order to match experimental data with
+  // P^z(phi)
+  const double xi_delta_coefficient = par.spline->Eval(z) * par.tuningFactor;
+  const double factor = ((xi_delta_coefficient * beta * beta) / z) * beta;
+  for (int mu = 0; mu < 4; mu++)
+   for (int rh = 0; rh < 4; rh++)
+    for (int ta = 0; ta < 4; ta++) {
+     double b = 0.;
+     for (int nu = 0; nu < 4; nu++)
+      for (int sg = 0; sg < 4; sg++)  // gmunu[sg][alph] is diagonal
+       b += levi(mu, nu, rh, sg) * u_[nu] * gmumu[sg] * el.sigma[ta][sg];
+     c.B[mu][rh][ta] = factor * b;
+    }
+ }
+ if (TERMS & TERM_SPIN0) {
+  // The first of David's new terms under the assumption that \Omega^{\mu\nu}=0.
+  // The factor 4 in front of D[mu] reproduces the original loop, where the
+  // first part of the term is inside the sum over bet
+  for (int mu = 0; mu < 4; mu++) {
+   c.D[mu] = 0.;
+   for (int nu = 0; nu < 4; nu++)
+    for (int rh = 0; rh < 4; rh++)
+     for (int sg = 0; sg < 4; sg++)
+      c.D[mu] += levi(mu, nu, rh, sg) * gmumu[rh] * gmumu[sg] * u_[nu]
+                 * el.dmuCart[rh][sg];
+  }
+ }
+}
+
+// Thread-local work arrays of a tile (batch) of elements: the prepared
+// elements, and for the gemm kernel their packed coefficients [k*nCoef + j]
+// and the weights of one momentum point for each element.
+struct tileBuffers {
+ vector<elementTerms> terms;
+ vector<double> coef, w, wXi, wE;
+ void resize(int nElem, int nCoef) {
+  terms.resize(nElem);
+  coef.resize(nElem * nCoef);
+  w.resize(nElem);
+  wXi.resize(nElem);
+  wE.resize(nElem);
+ }
+};
+
+// statistics of the element, counted once per element
+template <int TERMS, class E>
+inline void countElement(const E &el, const kernelParams &par,
+                         kernelSums &sums) {
+ const double z = el.invT * par.mass;
+ if (TERMS & TERM_SHEAR) {
+  if (z < 0.0001 || z > 20.0) sums.nZout++;
+ }
+ // store the global min/max values of z over all cells
+ if (z < sums.zMin) sums.zMin = z;
+ if (z > sums.zMax) sums.zMax = z;
+ if (el.flags & ELEM_BAD_DBETA) sums.nBadElem++;
+ //if(fabs(surf[iel].dbeta[0][0])>1000.0) continue;
+}
+
+// Adds the contribution of one prepared element to the momentum grid points
+// ip0 <= ip < ip1. TERMS is a compile-time set of TERM_ flags, so the
+// disabled terms are not compiled in.
+template <int TERMS>
+inline void calcMomenta(const elementTerms &c, const kernelParams &par,
+                        int ip0, int ip1, kernelSums &sums) {
+ const double kappa_coefficient = par.kappaCoefficient;
+ for (int ip = ip0; ip < ip1; ip++) {
+  const double *p = &pGrid[ip * 4];
+  const double p_[4] = {p[0], -p[1], -p[2], -p[3]};
+  double pds = 0., E_p = 0.;
+  for (int mu = 0; mu < 4; mu++) {
+   pds += p[mu] * c.dsigma[mu];
+   E_p += p[mu] * c.u[mu] * gmumu[mu];
+  }
+  const double nf = c1 / (exp( (E_p - c.mutot) / c.T) + 1.0);
+  if (nf > 1.0) sums.nFermiFail++;
+  const double w = pds * nf;
+  sums.den[ip] += w;
+  if (TERMS & TERM_STANDARD) {
+   // computing the 'standard' polarization expression. I deleted a factor (1. - nf) in every term!!!
+   double *num = &sums.num[0][ip * 4];
+   for (int mu = 0; mu < 4; mu++) {
+    double s = 0.;
+    for (int sg = 0; sg < 4; sg++) s += c.A[mu][sg] * p_[sg];
+    num[mu] += w * s;
+   }
+  }
+  if (TERMS & TERM_XI) {
+   // computing the extra 'xi' term for the polarization
+   double *num = &sums.num[1][ip * 4];
+   for (int mu = 0; mu < 4; mu++) {
+    double s = 0.;
+    for (int sg = 0; sg < 4; sg++)
+     for (int ta = 0; ta < 4; ta++) s += c.X[mu][sg][ta] * p_[sg] * p[ta];
+    num[mu] += w * (1. - nf) * s / p[0];
+   }
+  }
+  if (TERMS & TERM_SHEAR) {
+   double *num = &sums.num[2][ip * 4];
+   for (int mu = 0; mu < 4; mu++) {
+    double s = 0.;
+    for (int rh = 0; rh < 4; rh++)
+     for (int ta = 0; ta < 4; ta++) s += c.B[mu][rh][ta] * p_[rh] * p_[ta];
+    num[mu] += w * s;
+   }
+  }
+  if (TERMS & TERM_SPIN0) {
+   double *num = &sums.num[3][ip * 4];
+   double Dp = 0.;
+   for (int bet = 0; bet < 4; bet++) Dp += c.D[bet] * p_[bet];
+   for (int mu = 0; mu < 4; mu++)
+    num[mu] += w * kappa_coefficient * (4. * c.D[mu] - c.u[mu] / E_p * Dp);
+  }
+  const double pT_ip = sqrt(p[1] * p[1] + p[2] * p[2]);
+  sums.Qx1 += p[1] * w;
+  sums.Qy1 += p[2] * w;
+  sums.Qx2 += (p[1]*p[1] - p[2]*p[2])/(pT_ip+1e-10) * w;
+  sums.Qy2 += (p[1]*p[2])/(pT_ip+1e-10) * w;
+ }
+}
+
+// Adds the contribution of one element to all momentum grid points.
+template <int TERMS, class E>
+inline void calcElement(const E &el, const kernelParams &par,
+                        kernelSums &sums) {
+ countElement<TERMS>(el, par, sums);
+ elementTerms c;
+ prepareElement<TERMS>(el, par, c);
+ calcMomenta<TERMS>(c, par, 0, nMom, sums);
+}
+
+// Cache-blocked version of calcElement for the elements iel0 <= iel < iel1:
+// the elements are prepared into the compact array 'tile' first, then the
+// momentum grid is swept in blocks of tileMom points, each over all elements
+// of the tile. The tile (tileElem * sizeof(elementTerms)) and the block of
+// the accumulators stay in cache, while the untiled loop sweeps the whole
+// grid for every element.
+template <int TERMS, class E>
+void calcTile(const E *s, int iel0, int iel1, int tileMom,
+              const kernelParams &par, tileBuffers &buf, kernelSums &sums) {
+ for (int iel = iel0; iel < iel1; iel++) {
+  countElement<TERMS>(s[iel], par, sums);
+  prepareElement<TERMS>(s[iel], par, buf.terms[iel - iel0]);
+ }
+ for (int ip0 = 0; ip0 < nMom; ip0 += tileMom) {
+  const int ip1 = min(ip0 + tileMom, nMom);
+  for (int k = 0; k < iel1 - iel0; k++)
+   calcMomenta<TERMS>(buf.terms[k], par, ip0, ip1, sums);
+ }
+}
+
+// The gemm kernel. For a fixed element every term is a linear map from a
+// few momentum features (p_[sg] or the symmetric products p_[sg]*p_[ta]) to
+// Pi^mu, times a scalar weight (pds*nf for most terms). The coefficients of
+// a batch of elements are packed into a matrix C[k][j], j = feature*4 + mu,
+// and for every momentum point the accumulator row acc[ip][j] gets
+// sum_k weight[ip][k] * C[k][j], i.e. the batch is one matrix product
+// (momenta x elements) * (elements x coefficients). The momentum features
+// are applied once per thread at the end, see contractGemm.
+// Blocks of the coefficient rows, grouped by the weight they are used with:
+//  weight pds*nf:              standard (p_), shear (p_ p_), spin0 4*D (1)
+//  weight pds*nf*(1-nf)/p^0:   xi (p_ p_)
+//  weight pds*nf/E_p:          spin0 -u[mu]*D[bet] (p_)
+template <int TERMS>
+struct gemmLayout {
+ static const int nStd = (TERMS & TERM_STANDARD) ? 16 : 0;
+ static const int nShear = (TERMS & TERM_SHEAR) ? 40 : 0;
+ static const int nSpinA = (TERMS & TERM_SPIN0) ? 4 : 0;
+ static const int nXi = (TERMS & TERM_XI) ? 40 : 0;
+ static const int nSpinB = (TERMS & TERM_SPIN0) ? 16 : 0;
+ static const int oStd = 0, oShear = nStd, oSpinA = oShear + nShear;
+ static const int nW = oSpinA + nSpinA;  // columns with weight pds*nf
+ static const int oXi = nW, oSpinB = oXi + nXi;
+ static const int nCoef = oSpinB + nSpinB;
+};
+
+// the 10 index pairs sg <= ta of the symmetric features p_[sg]*p_[ta]
+const int pairSg[10] = {0, 0, 0, 0, 1, 1, 1, 2, 2, 3};
+const int pairTa[10] = {0, 1, 2, 3, 1, 2, 3, 2, 3, 3};
+
+// packs the coefficients of a prepared element into the row C of the
+// coefficient matrix; the xi term is rewritten to p_[sg]*p_[ta]*gmumu[ta]
+template <int TERMS>
+inline void packCoefficients(const elementTerms &c, const kernelParams &par,
+                             double *C) {
+ typedef gemmLayout<TERMS> L;
+ const double kappa = par.kappaCoefficient;
+ for (int mu = 0; mu < 4; mu++) {
+  if (TERMS & TERM_STANDARD)
+   for (int sg = 0; sg < 4; sg++) C[L::oStd + sg * 4 + mu] = c.A[mu][sg];
+  for (int k = 0; k < 10; k++) {
+   const int sg = pairSg[k], ta = pairTa[k];
+   if (TERMS & TERM_SHEAR)
+    C[L::oShear + k * 4 + mu] = c.B[mu][sg][ta] + (sg != ta ? c.B[mu][ta][sg] : 0.);
+   if (TERMS & TERM_XI)
+    C[L::oXi + k * 4 + mu] = c.X[mu][sg][ta] * gmumu[ta]
+      + (sg != ta ? c.X[mu][ta][sg] * gmumu[sg] : 0.);
+  }
+  if (TERMS & TERM_SPIN0) {
+   C[L::oSpinA + mu] = 4. * kappa * c.D[mu];
+   for (int bet = 0; bet < 4; bet++)
+    C[L::oSpinB + bet * 4 + mu] = -kappa * c.u[mu] * c.D[bet];
+  }
+ }
+}
+
+// gemm kernel for the elements iel0 <= iel < iel1 (one batch). With
+// compensated_sum, the batch is summed into a row of its own, which is added
+// to the accumulators with kahanAdd, so the compensation costs one Kahan
+// step per batch instead of per element.
+template <int TERMS, class E>
+void calcBatchGemm(const E *s, int iel0, int iel1, const kernelParams &par,
+                   tileBuffers &buf, kernelSums &sums) {
+ typedef gemmLayout<TERMS> L;
+ const int n = iel1 - iel0;
+ const bool compensated = config.compensatedSum;
+ double row[L::nCoef + 1];
+ for (int k = 0; k < n; k++) {
+  countElement<TERMS>(s[iel0 + k], par, sums);
+  prepareElement<TERMS>(s[iel0 + k], par, buf.terms[k]);
+  packCoefficients<TERMS>(buf.terms[k], par, &buf.coef[k * L::nCoef]);
+ }
+ for (int ip = 0; ip < nMom; ip++) {
+  const double *p = &pGrid[ip * 4];
+  // weights of all elements of the batch at this momentum
+  double den = 0.;
+  for (int k = 0; k < n; k++) {
+   const elementTerms &c = buf.terms[k];
+   double pds = 0., E_p = 0.;
+   for (int mu = 0; mu < 4; mu++) {
+    pds += p[mu] * c.dsigma[mu];
+    E_p += p[mu] * c.u[mu] * gmumu[mu];
+   }
+   const double nf = c1 / (exp( (E_p - c.mutot) / c.T) + 1.0);
+   if (nf > 1.0) sums.nFermiFail++;
+   const double w = pds * nf;
+   buf.w[k] = w;
+   if (TERMS & TERM_XI) buf.wXi[k] = w * (1. - nf) / p[0];
+   if (TERMS & TERM_SPIN0) buf.wE[k] = w / E_p;
+   den += w;
+  }
+  if (compensated) kahanAdd(sums.den[ip], sums.denC[ip], den);
+  else sums.den[ip] += den;
+  const double pT_ip = sqrt(p[1] * p[1] + p[2] * p[2]);
+  sums.Qx1 += p[1] * den;
+  sums.Qy1 += p[2] * den;
+  sums.Qx2 += (p[1]*p[1] - p[2]*p[2])/(pT_ip+1e-10) * den;
+  sums.Qy2 += (p[1]*p[2])/(pT_ip+1e-10) * den;
+  // acc[ip][:] += sum_k weight[k] * C[k][:]
+  double *acc = &sums.acc[ip * L::nCoef];
+  if (compensated) {
+   for (int j = 0; j < L::nCoef; j++) row[j] = 0.;
+   acc = row;
+  }
+  for (int k = 0; k < n; k++) {
+   const double *C = &buf.coef[k * L::nCoef];
+   const double w = buf.w[k];
+   for (int j = 0; j < L::nW; j++) acc[j] += w * C[j];
+   if (TERMS & TERM_XI) {
+    const double wXi = buf.wXi[k];
+    for (int j = L::oXi; j < L::oXi + L::nXi; j++) acc[j] += wXi * C[j];
+   }
+   if (TERMS & TERM_SPIN0) {
+    const double wE = buf.wE[k];
+    for (int j = L::oSpinB; j < L::oSpinB + L::nSpinB; j++) acc[j] += wE * C[j];
+   }
+  }
+  if (compensated) {
+   double *sum = &sums.acc[ip * L::nCoef], *c = &sums.accC[ip * L::nCoef];
+   for (int j = 0; j < L::nCoef; j++) kahanAdd(sum[j], c[j], row[j]);
+  }
+ }
+}
+
+// applies the momentum features to the gemm accumulators and adds the
+// result to the numerators
+template <int TERMS>
+void contractGemm(kernelSums &sums) {
+ typedef gemmLayout<TERMS> L;
+ for (int ip = 0; ip < nMom; ip++) {
+  if (config.compensatedSum) sums.den[ip] -= sums.denC[ip];
+  const double *p = &pGrid[ip * 4];
+  const double p_[4] = {p[0], -p[1], -p[2], -p[3]};
+  double pp[10];
+  for (int k = 0; k < 10; k++) pp[k] = p_[pairSg[k]] * p_[pairTa[k]];
+  double acc[L::nCoef + 1];
+  for (int j = 0; j < L::nCoef; j++) acc[j] = sums.acc[ip * L::nCoef + j];
+  if (config.compensatedSum)
+   for (int j = 0; j < L::nCoef; j++) acc[j] -= sums.accC[ip * L::nCoef + j];
+  for (int mu = 0; mu < 4; mu++) {
+   if (TERMS & TERM_STANDARD) {
+    double s = 0.;
+    for (int sg = 0; sg < 4; sg++) s += p_[sg] * acc[L::oStd + sg * 4 + mu];
+    sums.num[0][ip * 4 + mu] += s;
+   }
+   if (TERMS & TERM_XI) {
+    double s = 0.;
+    for (int k = 0; k < 10; k++) s += pp[k] * acc[L::oXi + k * 4 + mu];
+    sums.num[1][ip * 4 + mu] += s;
+   }
+   if (TERMS & TERM_SHEAR) {
+    double s = 0.;
+    for (int k = 0; k < 10; k++) s += pp[k] * acc[L::oShear + k * 4 + mu];
+    sums.num[2][ip * 4 + mu] += s;
+   }
+   if (TERMS & TERM_SPIN0) {
+    double s = acc[L::oSpinA + mu];
+    for (int bet = 0; bet < 4; bet++) s += p_[bet] * acc[L::oSpinB + bet * 4 + mu];
+    sums.num[3][ip * 4 + mu] += s;
+   }
+  }
+ }
+}
+
+// sets the OpenMP schedule used by the schedule(runtime) element loops;
+// chunkSize is the number of elements per loop iteration (tiles)
+void setElementSchedule(int chunkSize) {
+ omp_sched_t kind = omp_sched_dynamic;
+ if (config.schedule == "static") kind = omp_sched_static;
+ else if (config.schedule == "guided") kind = omp_sched_guided;
+ omp_set_schedule(kind, max(config.grain / chunkSize, 1));
+}
+
+// prints the time each thread spent on its elements and the load imbalance
+void reportBusyTime(const vector<double> &busy) {
+ double tmin = busy[0], tmax = busy[0], tsum = 0.;
+ for (int i = 0; i < busy.size(); i++) {
+  tmin = min(tmin, busy[i]);
+  tmax = max(tmax, busy[i]);
+  tsum += busy[i];
+ }
+ const double tmean = tsum / busy.size();
+ cout << "thread busy time [s]: min " << tmin << "  mean " << tmean << "  max "
+      << tmax << "  imbalance(max/mean) " << (tmean > 0. ? tmax / tmean : 1.) << endl;
+ cout << "per thread:";
+ for (int i = 0; i < busy.size(); i++) cout << " " << busy[i];
+ cout << endl;
+}
+
+// processes the elements iel0 <= iel < iel1 on the calling thread, untiled
+// (tileElem == 0) or in tiles of tileElem elements x tileMom momenta. The
+// gemm kernel works on batches of tileElem (default gemmBatch) elements and
+// always over all momenta.
+const int gemmBatch = 64;
+
+template <int TERMS, class E>
+void calcElements(const E *s, int iel0, int iel1, int tileElem, int tileMom,
+                  const kernelParams &par, tileBuffers &buf,
+                  kernelSums &sums) {
+ if (config.kernel == "gemm") {
+  const int batch = tileElem > 0 ? tileElem : gemmBatch;
+  for (int i = iel0; i < iel1; i += batch)
+   calcBatchGemm<TERMS>(s, i, min(i + batch, iel1), par, buf, sums);
+  return;
+ }
+ if (tileElem == 0) {
+  for (int iel = iel0; iel < iel1; iel++) calcElement<TERMS>(s[iel], par, sums);
+  return;
+ }
+ for (int i = iel0; i < iel1; i += tileElem)
+  calcTile<TERMS>(s, i, min(i + tileElem, iel1), tileMom, par, buf, sums);
+}
+
+// zeroed thread-local sums for the kernel specialized for TERMS
+template <int TERMS>
+void initSums(kernelSums &sums) {
+ sums.den.assign(nMom, 0.0);
+ for (int it = 0; it < nTerms; it++)
+  if (TERMS & (1 << it)) sums.num[it].assign(nMom * 4, 0.0);
+ if (config.kernel == "gemm")
+  sums.acc.assign(nMom * gemmLayout<TERMS>::nCoef, 0.0);
+ if (config.kernel == "gemm" && config.compensatedSum) {
+  sums.denC.assign(nMom, 0.0);
+  sums.accC.assign(nMom * gemmLayout<TERMS>::nCoef, 0.0);
+ }
+}
+
+// Chooses the tile sizes for 'tiling auto': times the candidate tilings
+// (and the untiled loop) on a sample of the surface on one thread and
+// returns the fastest in tileElem, tileMom. The results are printed to the
+// run log.
+template <int TERMS, class E>
+void tuneTiles(const E *s, const kernelParams &par, int &tileElem, int &tileMom) {
+ const int candElem[] = {32, 128, 512};
+ const int candMom[] = {16, 64, 256};
+ const int nSample = min(Nelem, 2048);
+ const bool gemm = config.kernel == "gemm";
+ kernelSums scratch;
+ initSums<TERMS>(scratch);
+ tileBuffers buf;
+ buf.resize(512, gemmLayout<TERMS>::nCoef);
+ // warm-up, then the untiled loop (default batch for gemm) as the reference
+ calcElements<TERMS>(s, 0, nSample, 0, 0, par, buf, scratch);
+ double t0 = omp_get_wtime();
+ calcElements<TERMS>(s, 0, nSample, 0, 0, par, buf, scratch);
+ double tbest = omp_get_wtime() - t0;
+ tileElem = 0;
+ tileMom = nMom;
+ const double norm = 1e9 / ((double)max(nSample, 1) * nMom);
+ cout << "tiling auto: ns per element*momentum: "
+      << (gemm ? "batch 64 " : "untiled ") << tbest * norm;
+ for (int ie = 0; ie < 3; ie++)
+  for (int im = 0; im < 3; im++) {
+   // the gemm kernel has no momentum blocks
+   if ((candMom[im] >= nMom || gemm) && im > 0) continue;
+   const int tm = gemm ? nMom : min(candMom[im], nMom);
+   t0 = omp_get_wtime();
+   calcElements<TERMS>(s, 0, nSample, candElem[ie], tm, par, buf, scratch);
+   const double t = omp_get_wtime() - t0;
+   cout << ", " << candElem[ie] << "x" << tm << " " << t * norm;
+   if (t < tbest) {
+    tbest = t;
+    tileElem = candElem[ie];
+    tileMom = tm;
+   }
+  }
+ cout << endl;
+}
+
+// adds the grids and statistics of s (a thread, a chunk) to total
+void addSums(kernelSums &total, const kernelSums &s) {
+ for (int ip = 0; ip < nMom; ip++) total.den[ip] += s.den[ip];
+ for (int it = 0; it < nTerms; it++)
+  for (int i = 0; i < s.num[it].size(); i++) total.num[it][i] += s.num[it][i];
+ total.Qx1 += s.Qx1; total.Qy1 += s.Qy1;
+ total.Qx2 += s.Qx2; total.Qy2 += s.Qy2;
+ total.nFermiFail += s.nFermiFail;
+ total.nBadElem += s.nBadElem;
+ total.nZout += s.nZout;
+ total.nSeriesCut += s.nSeriesCut;
+ total.zMin = min(total.zMin, s.zMin);
+ total.zMax = max(total.zMax, s.zMax);
+}
+
+// loop over all elements with the kernel specialized for TERMS;
+// each thread sums into its own grids which are added up at the end.
+// The element cost varies (bad elements, time ordering of the surface), so
+// the chunks are scheduled dynamically by default, see setElementSchedule.
+// With tiling, a scheduled chunk is a tile of elements. E is the element type
+// of the surface s, element or elementF.
+template <int TERMS, class E>
+void elementLoop(const E *s, const kernelParams &par, kernelSums &total) {
+ int tileElem = 0, tileMom = nMom;
+ if (config.tiling == "on") {
+  tileElem = max(config.tileElements, 1);
+  tileMom = min(max(config.tileMomenta, 1), nMom);
+ } else if (config.tiling == "auto" && Nelem > 0)
+  tuneTiles<TERMS>(s, par, tileElem, tileMom);
+ // the double surface keeps its tensors in the field arrays
+ const bool single = is_same<E, elementF>::value;
+ int bytes = sizeof(E);
+ for (int f = 0; f < nFields && !single; f++)
+  if (fieldData[f]) bytes += 16 * sizeof(double);
+ cout << "surface: " << (single ? "float" : "double")
+      << ", " << bytes << " bytes per element"
+      << (config.compensatedSum ? ", compensated sums" : "") << endl;
+ if (config.kernel == "gemm")
+  cout << "kernel: gemm, batches of " << (tileElem > 0 ? tileElem : gemmBatch)
+       << " elements" << endl;
+ else if (tileElem > 0)
+  cout << "kernel: direct, tiling: " << tileElem << " elements x " << tileMom
+       << " momenta" << endl;
+ else
+  cout << "kernel: direct, tiling: off" << endl;
+ // untiled, a chunk of the loop below is one element
+ const int chunkSize = tileElem > 0 ? tileElem
+   : (config.kernel == "gemm" ? gemmBatch : 1);
+ const int nChunks = (Nelem + chunkSize - 1) / chunkSize;
+ Progress progress("doCalculations", Nelem, omp_get_max_threads(),
+                   config.progressInterval, config.heartbeatFile);
+ vector<double> busy(omp_get_max_threads(), 0.);
+ setElementSchedule(chunkSize);
+ progress.start();
+ #pragma omp parallel
+ {
+  const int thread = omp_get_thread_num();
+  kernelSums sums;
+  initSums<TERMS>(sums);
+  tileBuffers buf;
+  buf.resize(chunkSize, gemmLayout<TERMS>::nCoef);
+  const double tstart = omp_get_wtime();
+  #pragma omp for schedule(runtime) nowait
+  for (int ichunk = 0; ichunk < nChunks; ichunk++) {  // loop over all elements
+   const int iel0 = ichunk * chunkSize;
+   const int iel1 = min(iel0 + chunkSize, Nelem);
+   calcElements<TERMS>(s, iel0, iel1, tileElem, tileMom, par, buf, sums);
+   progress.add(thread, iel1 - iel0);
+  }
+  if (config.kernel == "gemm") contractGemm<TERMS>(sums);
+  busy[thread] = omp_get_wtime() - tstart;
+  #pragma omp critical
+  addSums(total, sums);
+ }
+ progress.finish();
+ reportBusyTime(busy);
+}
+
+typedef void (*elementLoopFunc)(const element *, const kernelParams &, kernelSums &);
+typedef void (*elementLoopFuncF)(const elementF *, const kernelParams &, kernelSums &);
+
+// one specialization per combination of the TERM_ flags, for the double and
+// the float surface
+const elementLoopFunc elementLoops[1 << nTerms] = {
+ elementLoop<0, element>, elementLoop<1, element>, elementLoop<2, element>,
+ elementLoop<3, element>, elementLoop<4, element>, elementLoop<5, element>,
+ elementLoop<6, element>, elementLoop<7, element>, elementLoop<8, element>,
+ elementLoop<9, element>, elementLoop<10, element>, elementLoop<11, element>,
+ elementLoop<12, element>, elementLoop<13, element>, elementLoop<14, element>,
+ elementLoop<15, element>};
+const elementLoopFuncF elementLoopsF[1 << nTerms] = {
+ elementLoop<0, elementF>, elementLoop<1, elementF>, elementLoop<2, elementF>,
+ elementLoop<3, elementF>, elementLoop<4, elementF>, elementLoop<5, elementF>,
+ elementLoop<6, elementF>, elementLoop<7, elementF>, elementLoop<8, elementF>,
+ elementLoop<9, elementF>, elementLoop<10, elementF>, elementLoop<11, elementF>,
+ elementLoop<12, elementF>, elementLoop<13, elementF>, elementLoop<14, elementF>,
+ elementLoop<15, elementF>};
+
+// ---- boost-invariant surfaces (boost_invariant): the elements of one eta
+// slice stand for all the boosted copies of a 2+1D surface, and the integral
+// over the space-time rapidity is done analytically for every element.
+// Boosted along z by eta, a vector with an upper index is
+//   v(eta) = e^eta P+ v + P0 v + e^-eta P- v
+// with the light cone projectors of boostProjector; a lower index goes with
+// e^-eta P+ and e^eta P-. u, dmuCart and sigma (see shear_tensor) have upper
+// indices, dsigma a lower one. The contributions are then sums of e^(g eta)
+// times the Fermi-Dirac distribution, which is expanded as
+//   nf = c1 sum_k (-1)^(k+1) exp(-k (E_p - mu)/T),
+// and with E_p(eta) = mT u_perp cosh(eta + eta_u) - pT.uT for p at y = 0
+//   int deta e^(g eta) exp(-k mT u_perp cosh(eta + eta_u) / T)
+//     = e^(-g eta_u) 2 K_|g|(k mT u_perp / T).
+// The dsigma of the slice include its width boost_invariant_deta. The spin0
+// term is not available (its 1/E_p factor is not of this form).
+const int maxFermiSeries = 64;
+
+// entry mu,nu of P_g, g = -1 (P-), 0 (P0), 1 (P+)
+inline double boostProjector(int g, int mu, int nu) {
+ if (g == 0) return mu == nu && (mu == 1 || mu == 2) ? 1. : 0.;
+ if ((mu != 0 && mu != 3) || (nu != 0 && nu != 3)) return 0.;
+ return mu == nu ? 0.5 : 0.5 * g;
+}
+
+// Exponentially scaled modified Bessel functions e^x K_n(x), n = 0..4, from
+// K_n(x) = int_0^inf exp(-x cosh t) cosh(nt) dt with the trapezoidal rule,
+// which converges exponentially for this integrand (relative error ~1e-14).
+void besselKScaled(double x, double K[5]) {
+ const double h = min(0.2, 0.7 / sqrt(x));
+ for (int n = 0; n < 5; n++) K[n] = 0.5 * h;
+ for (int j = 1;; j++) {
+  const double ch = cosh(j * h);
+  const double e = h * exp(-x * (ch - 1.));
+  double c[5] = {1., ch, 0., 0., 0.};
+  for (int n = 2; n < 5; n++) c[n] = 2. * ch * c[n - 1] - c[n - 2];
+  for (int n = 0; n < 5; n++) K[n] += e * c[n];
+  if (e * c[4] < 1e-17 * K[4]) break;
+ }
+}
+
+// the parts of an element with e^(g eta), see above; index g + rank
+struct boostGrades {
+ double u[3][4], dsigma[3][4];
+ double dmuCart[5][4][4], sigma[5][4][4];
+ elementTerms A[5];  // A, X of the standard and xi terms
+ elementTerms B[7];  // B of the shear term, bilinear in u and sigma
+};
+
+template <int TERMS>
+void prepareBoostGrades(const element &el, const kernelParams &par, boostGrades &b) {
+ for (int g = -1; g <= 1; g++)
+  for (int mu = 0; mu < 4; mu++) {
+   b.u[g + 1][mu] = b.dsigma[g + 1][mu] = 0.;
+   for (int nu = 0; nu < 4; nu++) {
+    b.u[g + 1][mu] += boostProjector(g, mu, nu) * el.u[nu];
+    b.dsigma[g + 1][mu] += boostProjector(-g, mu, nu) * el.dsigma[nu];
+   }
+  }
+ for (int g = 0; g < 5; g++)
+  for (int mu = 0; mu < 4; mu++)
+   for (int nu = 0; nu < 4; nu++) b.dmuCart[g][mu][nu] = b.sigma[g][mu][nu] = 0.;
+ for (int g1 = -1; g1 <= 1; g1++)
+  for (int g2 = -1; g2 <= 1; g2++)
+   for (int mu = 0; mu < 4; mu++)
+    for (int nu = 0; nu < 4; nu++)
+     for (int al = 0; al < 4; al++)
+      for (int be = 0; be < 4; be++) {
+       const double P = boostProjector(g1, mu, al) * boostProjector(g2, nu, be);
+       if (P == 0.) continue;
+       b.dmuCart[g1 + g2 + 2][mu][nu] += P * el.dmuCart[al][be];
+       if (TERMS & TERM_SHEAR) b.sigma[g1 + g2 + 2][mu][nu] += P * el.sigma[al][be];
+      }
+ element e = el;
+ if (TERMS & (TERM_STANDARD | TERM_XI))
+  for (int g = 0; g < 5; g++) {
+   e.dmuCart = b.dmuCart[g];
+   prepareElement<TERMS & (TERM_STANDARD | TERM_XI)>(e, par, b.A[g]);
+  }
+ if (TERMS & TERM_SHEAR) {
+  for (int g = 0; g < 7; g++)
+   for (int i = 0; i < 64; i++) (&b.B[g].B[0][0][0])[i] = 0.;
+  elementTerms c;
+  for (int g1 = -1; g1 <= 1; g1++)
+   for (int g2 = -2; g2 <= 2; g2++) {
+    for (int mu = 0; mu < 4; mu++) e.u[mu] = b.u[g1 + 1][mu];
+    e.sigma = b.sigma[g2 + 2];
+    prepareElement<TERM_SHEAR>(e, par, c);
+    for (int i = 0; i < 64; i++) (&b.B[g1 + g2 + 3].B[0][0][0])[i] += (&c.B[0][0][0])[i];
+   }
+ }
+}
+
+// adds the eta integral of the element to all momentum grid points
+template <int TERMS>
+void calcElementBoostInvariant(const element &el, const kernelParams &par,
+                               boostGrades &b, kernelSums &sums) {
+ countElement<TERMS>(el, par, sums);
+ prepareBoostGrades<TERMS>(el, par, b);
+ const double mutot = el.mub * par.baryonCharge + el.muq * par.electricCharge
+   + el.mus * par.strangeness;
+ const double uPerp = sqrt(el.u[0] * el.u[0] - el.u[3] * el.u[3]);
+ const double uT = sqrt(el.u[1] * el.u[1] + el.u[2] * el.u[2]);
+ // e^(-eta_u) = r, powers r^g for g = -4..4
+ const double r = sqrt((el.u[0] - el.u[3]) / (el.u[0] + el.u[3]));
+ double rg[9];
+ rg[4] = 1.;
+ for (int g = 1; g <= 4; g++) {
+  rg[4 + g] = rg[3 + g] * r;
+  rg[4 - g] = rg[5 - g] / r;
+ }
+ const double norm = 2. * c1 / config.boostInvariantDeta;
+ const int nphi = phi.size();
+ double Ks[maxFermiSeries + 1][5];
+ for (int ipt = 0; ipt < pT.size(); ipt++) {
+  const double mT = pGrid[ipt * nphi * 4];
+  const double z0 = mT * uPerp * el.invT;
+  // (E_p - mu)/T at its minimum over eta and phi: the series converges as
+  // exp(-k x0)
+  const double x0min = z0 - (pT[ipt] * uT + mutot) * el.invT;
+  const int kmax = x0min > 40. / maxFermiSeries ? (int)ceil(40. / x0min) : maxFermiSeries;
+  for (int k = 1; k <= kmax; k++) besselKScaled(k * z0, Ks[k]);
+  for (int iphi = 0; iphi < nphi; iphi++) {
+   const int ip = ipt * nphi + iphi;
+   const double *p = &pGrid[ip * 4];
+   const double p_[4] = {p[0], -p[1], -p[2], -p[3]};
+   const double x0 = z0 - (p[1] * el.u[1] + p[2] * el.u[2] + mutot) * el.invT;
+   if (x0 * kmax < 40.) sums.nSeriesCut++;
+   // J[n] = int deta cosh(n eta) nf, Jxi with nf (1 - nf)
+   double J[5] = {0., 0., 0., 0., 0.}, Jxi[5] = {0., 0., 0., 0., 0.};
+   const double q = exp(-x0);
+   double qk = 1.;
+   for (int k = 1; k <= kmax; k++) {
+    qk *= (k > 1 ? -q : q);
+    for (int n = 0; n < 5; n++) {
+     J[n] += qk * Ks[k][n];
+     if (TERMS & TERM_XI) Jxi[n] += qk * (1. + c1 * (k - 1)) * Ks[k][n];
+    }
+   }
+   // weights of the parts e^(g eta), g = -4..4
+   double W[9], WXi[9];
+   for (int g = -4; g <= 4; g++) {
+    W[g + 4] = norm * rg[g + 4] * J[abs(g)];
+    WXi[g + 4] = norm * rg[g + 4] * Jxi[abs(g)] / p[0];
+   }
+   double pds[3];
+   for (int g = 0; g < 3; g++) {
+    pds[g] = 0.;
+    for (int mu = 0; mu < 4; mu++) pds[g] += p[mu] * b.dsigma[g][mu];
+   }
+   double den = 0.;
+   for (int g = -1; g <= 1; g++) den += pds[g + 1] * W[g + 4];
+   sums.den[ip] += den;
+   for (int mu = 0; mu < 4; mu++) {
+    if (TERMS & (TERM_STANDARD | TERM_XI))
+     for (int g2 = -2; g2 <= 2; g2++) {
+      const elementTerms &c = b.A[g2 + 2];
+      double s = 0., sXi = 0.;
+      for (int sg = 0; sg < 4; sg++) {
+       if (TERMS & TERM_STANDARD) s += c.A[mu][sg] * p_[sg];
+       if (TERMS & TERM_XI)
+        for (int ta = 0; ta < 4; ta++) sXi += c.X[mu][sg][ta] * p_[sg] * p[ta];
+      }
+      for (int g1 = -1; g1 <= 1; g1++) {
+       if (TERMS & TERM_STANDARD) sums.num[0][ip * 4 + mu] += pds[g1 + 1] * s * W[g1 + g2 + 4];
+       if (TERMS & TERM_XI) sums.num[1][ip * 4 + mu] += pds[g1 + 1] * sXi * WXi[g1 + g2 + 4];
+      }
+     }
+    if (TERMS & TERM_SHEAR)
+     for (int g2 = -3; g2 <= 3; g2++) {
+      const elementTerms &c = b.B[g2 + 3];
+      double s = 0.;
+      for (int rh = 0; rh < 4; rh++)
+       for (int ta = 0; ta < 4; ta++) s += c.B[mu][rh][ta] * p_[rh] * p_[ta];
+      for (int g1 = -1; g1 <= 1; g1++)
+       sums.num[2][ip * 4 + mu] += pds[g1 + 1] * s * W[g1 + g2 + 4];
+     }
+   }
+   const double pT_ip = sqrt(p[1] * p[1] + p[2] * p[2]);
+   sums.Qx1 += p[1] * den;
+   sums.Qy1 += p[2] * den;
+   sums.Qx2 += (p[1]*p[1] - p[2]*p[2])/(pT_ip+1e-10) * den;
+   sums.Qy2 += (p[1]*p[2])/(pT_ip+1e-10) * den;
+  }
+ }
+}
+
+// element loop of boost_invariant, like elementLoop
+template <int TERMS>
+void boostInvariantLoop(const element *s, const kernelParams &par, kernelSums &total) {
+ cout << "kernel: boost invariant, eta slice width " << config.boostInvariantDeta << endl;
+ Progress progress("doCalculations", Nelem, omp_get_max_threads(),
+                   config.progressInterval, config.heartbeatFile);
+ setElementSchedule();
+ progress.start();
+ #pragma omp parallel
+ {
+  const int thread = omp_get_thread_num();
+  kernelSums sums;
+  initSums<TERMS>(sums);
+  boostGrades *b = new boostGrades;
+  #pragma omp for schedule(runtime) nowait
+  for (int iel = 0; iel < Nelem; iel++) {
+   calcElementBoostInvariant<TERMS>(s[iel], par, *b, sums);
+   progress.add(thread, 1);
+  }
+  delete b;
+  #pragma omp critical
+  addSums(total, sums);
+ }
+ progress.finish();
+}
+
+// the terms without spin0
+const elementLoopFunc boostInvariantLoops[1 << (nTerms - 1)] = {
+ boostInvariantLoop<0>, boostInvariantLoop<1>, boostInvariantLoop<2>,
+ boostInvariantLoop<3>, boostInvariantLoop<4>, boostInvariantLoop<5>,
+ boostInvariantLoop<6>, boostInvariantLoop<7>};
+
+// particle properties and the mass shell of the momentum grid
+void setupParticle(int pid, kernelParams &par) {
  particle = database->GetPDGParticle(pid);
  const double mass = particle->GetMass();  // pion
  std::cout << "Lambda mass: " << mass << std::endl;
- const double baryonCharge = particle->GetBaryonNumber();
- const double electricCharge = particle->GetElectricCharge();
- const double strangeness = particle->GetStrangeness();
+ par.mass = mass;
+ par.baryonCharge = particle->GetBaryonNumber();
+ par.electricCharge = particle->GetElectricCharge();
+ par.strangeness = particle->GetStrangeness();
  cout << "calculations for: " << particle->GetName() << ", charges = "
-  << baryonCharge << "  " << electricCharge << "  " << strangeness << endl;
- int nFermiFail = 0; // number of elements where nf>1.0
- int nBadElem = 0;
- double Qx1=0., Qy1=0., Qx2=0., Qy2=0.;
- double z_limits[2];
-
- // This block is needed to import the coefficient csv file from
- // David and make an interpolation with ROOT
- //**************************************************************
- const std::string coefficient_filename = "/Users/nils/Desktop/Projects/Polarization/Coefficients/coeffData.csv";
- const std::string output_filename = "interpolationTable.txt";
- // Call function to obtain the interpolation TSpline3 object
- const TSpline3* spline = getInterpolationSpline(coefficient_filename);
+  << par.baryonCharge << "  " << par.electricCharge << "  " << par.strangeness << endl;
+ for (int ip = 0; ip < nMom; ip++) {
+  double *p = &pGrid[ip * 4];
+  if (!yNode.empty()) {
+   const double mT = sqrt(mass * mass + p[1] * p[1] + p[2] * p[2]);
+   const double y = yNode[ip / (pT.size() * phi.size())];
+   p[0] = mT * cosh(y);
+   p[3] = mT * sinh(y);
+  } else
+   p[0] = sqrt(mass * mass + p[1] * p[1] + p[2] * p[2] + p[3] * p[3]);
+ }
+}
+
+// This is needed to import the coefficient csv file from
+// David and make a cubic spline interpolation; only the shear term uses it
+const CubicSpline *loadCoefficientSpline(const string &file) {
+ // Call function to obtain the interpolation spline object
+ const CubicSpline *spline = getInterpolationSpline(file);
  if (!spline) {
      std::cerr << "Failed to obtain interpolation spline." << std::endl;
      exit(1);
  }
- saveTableToFile(spline, output_filename);
- //**************************************************************
+ if (!config.interpolationTable.empty())
+  saveTableToFile(spline, config.interpolationTable);
+ return spline;
+}
 
- int processedCount = 0; // Shared counter to track progress
- #pragma omp parallel for
- for (int iel = 0; iel < Nelem; iel++) {  // loop over all elements
-  
- // if (iel % 1000 == 0)
- //  std::cout << "###### iel For-Loop reached element " << iel << " ######\n" << std::endl;
-
-  const double u_[4] = {surf[iel].u[0], -surf[iel].u[1], -surf[iel].u[2], -surf[iel].u[3]};
-  const element surf_element = surf[iel];
-  const double beta = 1. / surf[iel].T;
-  const double z = beta * mass;
-  if(z<0.0001 || z>20.0){
-    std::cout << "z outside the range [0.0001, 20.0]. Increase interpolation range!!!\n" << std::endl;
-  }
-  // store the global min/max values of z over all cells
-  if(iel == 0) {
-    z_limits[0] = z_limits[1] = z;
-  } else if(z < z_limits[0]) {
-    z_limits[0] = z;
-  } else if(z > z_limits[1]) {
-    z_limits[1] = z;
-  }
-  if (iel == Nelem-1){
-    {
-      std::cout << "Z Range Used During Simulation:" << std::endl;
-      std::cout << "-------------------------------\n" << std::endl;
-      std::cout << "z_min: " << z_limits[0] << " ,     z_max: " << z_limits[1] << std::endl; 
-    }
+// Runs the kernel for the TERM_ flags 'terms' over the surface (surfF if
+// single, else surf); total gets the grids and statistics, with MPI summed
+// over all ranks (the grids on rank 0 only)
+void calcGrids(const kernelParams &par, int terms, kernelSums &total,
+               bool single) {
+ total.den.assign(nMom, 0.0);
+ for (int it = 0; it < nTerms; it++) total.num[it].assign(nMom * 4, 0.0);
+ if (config.boostInvariant)
+  boostInvariantLoops[terms & ((1 << (nTerms - 1)) - 1)](surf, par, total);
+ else if (single)
+  elementLoopsF[terms & ((1 << nTerms) - 1)](surfF, par, total);
+ else
+  elementLoops[terms & ((1 << nTerms) - 1)](surf, par, total);
+#ifdef USE_MPI
+ // each rank has processed its slice of the surface: sum the grids and the
+ // statistics on rank 0, which writes the output
+ int rank;
+ MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+ double *den = rank == 0 ? (double *)MPI_IN_PLACE : &total.den[0];
+ MPI_Reduce(den, &total.den[0], nMom, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+ for (int it = 0; it < nTerms; it++)
+  if (terms & (1 << it)) {
+   double *num = rank == 0 ? (double *)MPI_IN_PLACE : &total.num[it][0];
+   MPI_Reduce(num, &total.num[it][0], nMom * 4, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
   }
+ double Q[4] = {total.Qx1, total.Qy1, total.Qx2, total.Qy2};
+ MPI_Allreduce(MPI_IN_PLACE, Q, 4, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+ total.Qx1 = Q[0]; total.Qy1 = Q[1]; total.Qx2 = Q[2]; total.Qy2 = Q[3];
+ int counts[3] = {total.nBadElem, total.nFermiFail, total.nZout};
+ MPI_Allreduce(MPI_IN_PLACE, counts, 3, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+ total.nBadElem = counts[0];
+ total.nFermiFail = counts[1]; total.nZout = counts[2];
+ MPI_Allreduce(MPI_IN_PLACE, &total.zMin, 1, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
+ MPI_Allreduce(MPI_IN_PLACE, &total.zMax, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+#endif
+}
 
-  // The tuning factor is non-physical and is just to test how large the 
-  // xi_delta_coefficient must be in order to match experimental data with 
-  // P^z(phi)
-  const double tuning_factor = 0.37;
-  const double xi_delta_coefficient = spline->Eval(z) * tuning_factor;
-
-  // The kappa_coefficient is just a placeholder until I get the real data
-  // from David. We assume, that it behaves like negative temperature times
-  // some number. Here, this number is kappa_tuning_factor that I can use
-  // to study the qualitative effect of the new term
-  const double kappa_tunig_factor = 1.0 ;
-  const double kappa_coefficient = -11.5 * kappa_tunig_factor ;
-  
-  if(fabs(surf[iel].dbeta[0][0])>1000.0) nBadElem++;
-  //if(fabs(surf[iel].dbeta[0][0])>1000.0) continue;
-  for (int ipt = 0; ipt < pT.size(); ipt++)
-   for (int iphi = 0; iphi < phi.size(); iphi++) {
-    const double mT = sqrt(mass * mass + pT[ipt] * pT[ipt]);
-    const double p[4] = {mT, pT[ipt]*cos(phi[iphi]), pT[ipt]*sin(phi[iphi]), 0};
-    const double p_[4] = {mT, -pT[ipt]*cos(phi[iphi]), -pT[ipt]*sin(phi[iphi]), 0};
-    double pds = 0., E_p = 0.;
-    for (int mu = 0; mu < 4; mu++) {
-     pds += p[mu] * surf[iel].dsigma[mu];
-     E_p += p[mu] * surf[iel].u[mu] * gmumu[mu];
-    }
-    const double mutot = surf[iel].mub * baryonCharge
-      + surf[iel].muq * electricCharge + surf[iel].mus * strangeness;
-    const double nf = c1 / (exp( (E_p - mutot) / surf[iel].T) + 1.0);
-    if(nf > 1.0) nFermiFail++;
-    Pi_den[ipt][iphi] += pds * nf ;
-    for(int mu=0; mu<4; mu++)
-     for(int nu=0; nu<4; nu++)
-      for(int rh=0; rh<4; rh++)
-       for(int sg=0; sg<4; sg++) {
-
-
-        // Andrea: change zetaSparams in vHLLE to 3 
-        // Maybe also change e_crit to 0.4 
-
-        //pds = p x dsigma
-        //surf[iel].dbeta[ta][rh] = varpi_{mu nu}
-        // computing the 'standard' polarization expression. I deleted a factor (1. - nf) in every term!!!
-        Pi_num[ipt][iphi][mu] += pds * nf * levi(mu, nu, rh, sg)
-                               * p_[sg] * surf[iel].dmuCart[nu][rh]/surf[iel].T;
-        
-        // //David's formula with extra gmunu because I have shear tensor with upper indices (Euclidean) only
-        for(int ta=0; ta<4; ta++) {
-          for(int alph=0; alph<4; alph++){
-            Pi_num_navierstokes[ipt][iphi][mu] += pds * nf * ((xi_delta_coefficient*beta*beta)/z)
-                                    * beta * levi(mu, nu, rh, sg) * u_[nu] * p_[rh]
-                                    * gmunu[sg][alph] * shear_tensor(&surf_element, ta, alph) * p_[ta];
-          }
-        }
-
-        //David's formula with 4-velocity u replaced by t vector tvect by Iurii
-        // for(int ta=0; ta<4; ta++) {
-        //   for(int alph=0; alph<4; alph++){
-        //     Pi_num_navierstokes[ipt][iphi][mu] += pds * nf * ((xi_delta_coefficient*beta*beta)/z)
-        //                             * beta * levi(mu, nu, rh, sg) * tvect[nu] * p_[rh]
-        //                             * gmunu[sg][alph] * shear_tensor(&surf_element, ta, alph) * p_[ta];
-        //   }
-        // }
-        
-        // The first of David's new terms under the assumption that \Omega^{\mu\nu}=0
-        // for(int ta=0; ta<4; ta++) {
-        //   for(int alph=0; alph<4; alph++) {
-        //     for(int bet=0; bet<4; bet++) {
-        //       Pi_num_spin_potential_zero[ipt][iphi][mu] += pds * nf * kappa_coefficient 
-        //       *((levi(mu, nu, rh, sg) * gmunu[rh][ta] * gmunu[sg][alph] * u_[nu] * surf[iel].dmuCart[ta][alph]) 
-        //       - ((1./E_p) * p_[bet]) * levi(bet, nu, rh, sg) * gmunu[rh][ta] * gmunu[sg][alph] * u_[nu] * surf[iel].dmuCart[ta][alph] * surf[iel].u[mu]) ;
-        //     }
-        //   }
-        // }
-
-        // computing the extra 'xi' term for the polarization
-        // Check out on isothermal branch of vhlle. Here, I use my dmuCart/T as an updated version
-        // instead of dbeta as it is equivalent to the thermal vorticity in the case of the isothermal branch
-        //  for(int ta=0; ta<4; ta++)
-        //  Pi_num_xi[ipt][iphi][mu] += pds * nf * (1. - nf) * levi(mu, nu, rh, sg)
-        //              * p_[sg] * p[ta] / p[0] * tvect[nu]
-        //              * ( surf[iel].dmuCart[rh][ta]/surf[iel].T + surf[iel].dmuCart[ta][rh]/surf[iel].T);
-       }
-
-    Qx1 += p[1] * pds * nf;
-    Qy1 += p[2] * pds * nf;
-    Qx2 += (p[1]*p[1] - p[2]*p[2])/(pT[ipt]+1e-10) * pds * nf;
-    Qy2 += (p[1]*p[2])/(pT[ipt]+1e-10) * pds * nf;
+// total number of elements, over all MPI ranks
+int totalElements() {
+ int n = Nelem;
+#ifdef USE_MPI
+ MPI_Allreduce(MPI_IN_PLACE, &n, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+#endif
+ return n;
+}
+
+// nElements: the number of elements summed in total
+void printSummary(const kernelSums &total, int nElements) {
+ if (total.nZout > 0)
+  std::cout << total.nZout << " elements with z outside the range [0.0001, 20.0]."
+            << " Increase interpolation range!!!\n" << std::endl;
+ std::cout << "Z Range Used During Simulation:" << std::endl;
+ std::cout << "-------------------------------\n" << std::endl;
+ std::cout << "z_min: " << total.zMin << " ,     z_max: " << total.zMax << std::endl;
+ cout << "doCalculations: total, bad = " << setw(12) << nElements << setw(12) << total.nBadElem << endl;
+ cout << "number of elements*pT configurations where nf>1.0: " << total.nFermiFail
+  << endl;
+ if (total.nSeriesCut > 0)
+  cout << "boost_invariant: " << total.nSeriesCut << " elements*pT configurations with"
+       << " (E_p - mu)/T < " << 40. / maxFermiSeries << ", Fermi series cut" << endl;
+ cout << "event_plane_vectors: " << total.Qx1 << "  " << total.Qy1 << "  "
+   << total.Qx2 << "  " << total.Qy2 << endl;
+}
+
+// Converts the surface to single precision for precision float/validate.
+// Without keepDouble the double surface is freed, after the conversion: both
+// surfaces are in memory at the peak.
+void makeFloatSurface(bool keepDouble) {
+ surfF = new elementF[Nelem];
+ setElementSchedule();
+ #pragma omp parallel for schedule(runtime)
+ for (int n = 0; n < Nelem; n++) {
+  const element &el = surf[n];
+  elementF &f = surfF[n];
+  for (int mu = 0; mu < 4; mu++) {
+   f.u[mu] = el.u[mu];
+   f.dsigma[mu] = el.dsigma[mu];
+   for (int nu = 0; nu < 4; nu++) {
+    f.dmuCart[mu][nu] = el.dmuCart[mu][nu];
+    f.sigma[mu][nu] = el.sigma ? el.sigma[mu][nu] : 0.;
    }
-  // Increment the processed count for each thread
-  #pragma omp atomic
-  processedCount++;
-  if (processedCount % 1000 == 0) {
-        cout << "processed " << processedCount / 1000 << "k elements\n";
   }
- }  // loop over all elements
- delete[] surf;
- cout << "doCalculations: total, bad = " << setw(12) << Nelem << setw(12) << nBadElem << endl;
- cout << "number of elements*pT configurations where nf>1.0: " << nFermiFail
-  << endl;
- cout << "event_plane_vectors: " << Qx1 << "  " << Qy1 << "  "
-   << Qx2 << "  " << Qy2 << endl;
+  f.T = el.T;
+  f.mub = el.mub;
+  f.muq = el.muq;
+  f.mus = el.mus;
+  f.invT = el.invT;
+  f.flags = el.flags;
+ }
+ if (!keepDouble) freeSurface();
+}
+
+double termNorm(int it);
+
+// precision validate: compares the grids from the float surface with the
+// ones from the double surface. For each grid the largest deviation relative
+// to the largest value, and for the terms the largest absolute deviation of
+// the output polarization (numerator * norm / denominator).
+void reportPrecision(const kernelSums &ref, const kernelSums &single, int terms) {
+ double maxRef = 0., maxDiff = 0.;
+ for (int ip = 0; ip < nMom; ip++) {
+  maxRef = max(maxRef, fabs(ref.den[ip]));
+  maxDiff = max(maxDiff, fabs(single.den[ip] - ref.den[ip]));
+ }
+ cout << "precision validate: float vs double surface" << endl;
+ cout << "  den: max |diff| / max |double| = " << maxDiff / maxRef << endl;
+ for (int it = 0; it < nTerms; it++) {
+  if (!(terms & (1 << it))) continue;
+  double maxNum = 0., maxNumDiff = 0., maxP = 0., maxPDiff = 0.;
+  for (int ip = 0; ip < nMom; ip++)
+   for (int mu = 0; mu < 4; mu++) {
+    const double a = ref.num[it][ip * 4 + mu], b = single.num[it][ip * 4 + mu];
+    maxNum = max(maxNum, fabs(a));
+    maxNumDiff = max(maxNumDiff, fabs(b - a));
+    const double Pa = a * termNorm(it) / ref.den[ip];
+    const double Pb = b * termNorm(it) / single.den[ip];
+    maxP = max(maxP, fabs(Pa));
+    maxPDiff = max(maxPDiff, fabs(Pb - Pa));
+   }
+  cout << "  " << termName(1 << it) << ": max |diff| / max |double| = "
+       << (maxNum > 0. ? maxNumDiff / maxNum : 0.) << ", polarization: max |diff| = "
+       << maxPDiff << " (max |P| = " << maxP << ")" << endl;
+ }
+}
+
+// particle and coefficients for the configured terms and factors
+void setupKernel(int pid, kernelParams &par) {
+ setupParticle(pid, par);
+ par.spline = 0;
+ if (config.terms & TERM_SHEAR)
+  par.spline = loadCoefficientSpline(config.coefficientFile);
+ par.tuningFactor = config.tuningFactor;
+ // The kappa_coefficient is just a placeholder until I get the real data
+ // from David. We assume, that it behaves like negative temperature times
+ // some number. Here, this number is kappa_tuning_factor that I can use
+ // to study the qualitative effect of the new term
+ par.kappaCoefficient = config.kappaCoefficient * config.kappaTuningFactor;
+}
+
+void doCalculations(int pid) {
+ kernelParams par;
+ setupKernel(pid, par);
+
+ kernelSums total;
+ if (config.precision == "validate") {
+  // the output is the one from the double surface
+  makeFloatSurface(true);
+  calcGrids(par, config.terms, total, false);
+  kernelSums single;
+  calcGrids(par, config.terms, single, true);
+  reportPrecision(total, single, config.terms);
+ } else {
+  if (config.precision == "float") makeFloatSurface(false);
+  calcGrids(par, config.terms, total, config.precision == "float");
+ }
+ Pi_den.swap(total.den);
+ for (int it = 0; it < nTerms; it++) Pi_num[it].swap(total.num[it]);
+ printSummary(total, totalElements());
+ freeSurface();
+ delete[] surfF;
 
  std::cout << "###### doCalculations finished ######\n" << std::endl;
 }
 
-void calcInvariantQuantities() {
- const double tvect[4] = {1.,0., 0., 0.};
- int nBadElem = 0;
- for (int iel = 0; iel < Nelem; iel++) {  // loop over all elements
-  if(fabs(surf[iel].dbeta[0][0])>1000.0) nBadElem++;
-  double symm_deriv = 0.0, asymm_deriv = 0.0, mod_deriv = 0.0;
-  for(int mu=0; mu<4; mu++)
-   for(int nu=0; nu<4; nu++) {
-    symm_deriv += 0.25*pow(hbarC*(surf[iel].dbeta[mu][nu]+surf[iel].dbeta[nu][mu]),2)
-		    *gmumu[mu]*gmumu[nu];
-    asymm_deriv += 0.25*pow(hbarC*(surf[iel].dbeta[mu][nu]-surf[iel].dbeta[nu][mu]),2)
-		    *gmumu[mu]*gmumu[nu];
-    mod_deriv += pow(hbarC*(surf[iel].dbeta[mu][nu]),2)
-		    *gmumu[mu]*gmumu[nu];
-    //for(int rh=0; rh<4; rh++)
-     //for(int sg=0; sg<4; sg++) {
-      //// computing the 'standard' polarization expression
-      //Pi_num[ipt][iphi][mu] += pds * nf * (1. - nf) * levi(mu, nu, rh, sg)
-                              //* p_[sg] * surf[iel].dbeta[nu][rh];
-      //// computing the extra 'xi' term for the polarization
-      //for(int ta=0; ta<4; ta++)
-       //Pi_num_xi[ipt][iphi][mu] += pds * nf * (1. - nf) * levi(mu, nu, rh, sg)
-                   //* p_[sg] * p[ta] / p[0] * tvect[nu]
-                   //* ( surf[iel].dbeta[rh][ta] + surf[iel].dbeta[ta][rh]);
-     //} // mu-nu-rho-sigma loop
-    } // mu-nu loop
-    if(fabs(surf[iel].eta)<0.5) {
-     //sqroot1 = sqrt(sqroot1);
-     if(symm_deriv!=symm_deriv)
-      cout << "symm_deriv=nan\n";
-     histSymm->Fill(symm_deriv);
-     histAsymm->Fill(asymm_deriv);
-     histMod->Fill(mod_deriv);
+// ---- incremental calculation: the surface is added in chunks, each chunk is
+// processed and freed before the next one (follow mode, library in pcalc.h)
+kernelParams chunkPar;
+kernelSums chunkTotal;
+int chunkElements; // elements added since beginChunks
+
+void beginChunks(int pid) {
+ setupKernel(pid, chunkPar);
+ chunkTotal = kernelSums();
+ chunkTotal.den.assign(nMom, 0.0);
+ for (int it = 0; it < nTerms; it++) chunkTotal.num[it].assign(nMom * 4, 0.0);
+ chunkElements = 0;
+}
+
+// processes the Nelem preprocessed elements in surf, adds them to chunkTotal
+// and frees them
+void calcChunk() {
+ const bool single = config.precision == "float";
+ if (single) makeFloatSurface(false);
+ kernelSums sums;
+ calcGrids(chunkPar, config.terms, sums, single);
+ addSums(chunkTotal, sums);
+ chunkElements += Nelem;
+ freeSurface();
+ delete[] surfF;
+ surfF = 0;
+}
+
+void addTextChunk(const string &text, int n) {
+ allocateSurface(n, surfaceFields());
+ istringstream in(text);
+ readElements(in);
+ preprocessElements();
+ calcChunk();
+}
+
+void addElementChunk(const double *values, int n, long stride) {
+ allocateSurface(n, surfaceFields());
+ setElementSchedule();
+ #pragma omp parallel for schedule(runtime)
+ for (int i = 0; i < n; i++) {
+  const double *v = values + i * stride;
+  element &el = surf[i];
+  el.tau = v[0];
+  el.x = v[1];
+  el.y = v[2];
+  el.eta = v[3];
+  for (int mu = 0; mu < 4; mu++) {
+   el.dsigma[mu] = v[4 + mu];
+   el.u[mu] = v[8 + mu];
+  }
+  el.T = v[12];
+  el.mub = v[13];
+  el.muq = v[14];
+  el.mus = v[15];
+  el.dbeta00 = v[16];
+  for (int j = 0; j < 16; j++) {
+   if (el.dbeta) el.dbeta[j / 4][j % 4] = v[16 + j];
+   if (el.dmuCart) el.dmuCart[j / 4][j % 4] = v[32 + j];
+  }
+ }
+ preprocessElements();
+ calcChunk();
+}
+
+void addFileChunk(char *filename, int N) {
+ load(filename, N, surfaceFields());
+ if (config.boostInvariant) selectEtaSlice();  // as in calc
+ calcChunk();
+}
+
+void finishChunks() {
+ Pi_den.swap(chunkTotal.den);
+ for (int it = 0; it < nTerms; it++) Pi_num[it].swap(chunkTotal.num[it]);
+ printSummary(chunkTotal, chunkElements);
+}
+
+// Follow mode: processes a surface while it is being written. Complete lines
+// appended to the file (or written to the named pipe) are collected into
+// chunks of follow_chunk elements, and a chunk is processed when it is full or
+// when no new lines arrived in the last follow_interval seconds. A line equal
+// to follow_end, the end of a pipe, or follow_timeout seconds without new
+// lines (if > 0) end the surface.
+void doFollowCalculations(char *filename, int pid) {
+ beginChunks(pid);
+ surfaceName = filename;
+ struct stat st;
+ const bool pipe = stat(filename, &st) == 0 && S_ISFIFO(st.st_mode);
+ // the lines are parsed as they are appended, so the file must be plain text
+ const int format = pipe ? COMPRESSION_NONE : detectCompression(filename);
+ if (format != COMPRESSION_NONE) {
+  cout << "follow needs an uncompressed surface, " << filename << " is "
+       << compressionName(format) << " compressed" << endl;
+  exit(1);
+ }
+ ifstream fin(filename);
+ if (!fin) {
+  cout << "cannot read file " << filename << endl;
+  exit(1);
+ }
+ cout << "following " << (pipe ? "pipe " : "file ") << filename << ", end marker \""
+      << config.followEnd << "\"" << endl;
+ const int chunkMax = max(config.followChunk, 1);
+ string chunk, pending, line;
+ int nChunk = 0, iChunk = 0;
+ double idle = 0.;  // seconds without new lines
+ bool finished = false;
+ while (!finished) {
+  int nNew = 0;
+  while (!finished && nChunk < chunkMax && getline(fin, line)) {
+   if (fin.eof()) {  // the writer is in the middle of the line
+    pending += line;
+    break;
    }
- }  // loop over all elements
- histSymm->Scale(1./histSymm->Integral(),"width");
- histAsymm->Scale(1./histAsymm->Integral(),"width");
- histMod->Scale(1./histMod->Integral(),"width");
- plotSymm->cd();
- histSymm->Draw("H");
- plotAsymm->cd();
- histAsymm->Draw("H");
- plotMod->cd();
- histMod->Draw("H");
+   line = pending + line;
+   pending.clear();
+   if (line == config.followEnd) {
+    finished = true;
+    break;
+   }
+   chunk += line;
+   chunk += '\n';
+   nChunk++;
+   nNew++;
+  }
+  if (nNew > 0) idle = 0.;
+  const bool full = nChunk >= chunkMax;
+  if (!full && !finished) {
+   if (pipe && fin.eof()) finished = true;  // the writer has closed the pipe
+   else if (config.followTimeout > 0. && idle >= config.followTimeout) {
+    cout << "follow: no new lines for " << idle << " s, no end marker; finishing" << endl;
+    finished = true;
+   }
+  }
+  // the chunk is processed when it is full, when the hydro pauses, or at the end
+  if (nChunk > 0 && (full || finished || nNew == 0)) {
+   cout << "follow: chunk " << iChunk++ << ", " << nChunk << " elements, "
+        << chunkElements + nChunk << " in total" << endl;
+   addTextChunk(chunk, nChunk);
+   chunk.clear();
+   nChunk = 0;
+  } else if (!full && !finished) {
+   this_thread::sleep_for(chrono::duration<double>(config.followInterval));
+   idle += config.followInterval;
+  }
+  fin.clear();
+ }
+ if (!pending.empty())
+  cout << "follow: incomplete last line ignored: " << pending.substr(0, 40) << endl;
+ finishChunks();
+
+ std::cout << "###### doCalculations finished ######\n" << std::endl;
+}
+
+// Parameter scan. The shear term is linear in tuning_factor and in the
+// values of the xi_delta(z) table (for fixed z nodes), the spin0 term is
+// linear in kappa_tuning_factor, so the grids are computed once with both
+// factors 1 and scaled for every scan point. Each further coefficient table
+// needs one more pass over the surface, for the shear term only.
+vector<vector<double> > scanShear; // unscaled shear numerators per table
+vector<double> scanSpin0;          // unscaled spin0 numerators
+
+int nScanTables() {
+ return config.scanCoefficientFiles.empty() ? 1 : config.scanCoefficientFiles.size();
+}
+
+void doScanCalculations(int pid) {
+ vector<string> tables = config.scanCoefficientFiles;
+ if (tables.empty()) tables.push_back(config.coefficientFile);
+ kernelParams par;
+ setupParticle(pid, par);
+ par.spline = 0;
+ if (config.terms & TERM_SHEAR) par.spline = loadCoefficientSpline(tables[0]);
+ par.tuningFactor = 1.0;
+ par.kappaCoefficient = config.kappaCoefficient;
+ const bool single = config.precision == "float";
+ if (single) makeFloatSurface(false);
+ kernelSums total;
+ calcGrids(par, config.terms, total, single);
+ Pi_den.swap(total.den);
+ for (int it = 0; it < nTerms; it++) Pi_num[it].swap(total.num[it]);
+ printSummary(total, totalElements());
+ scanShear.assign(1, Pi_num[2]);
+ scanSpin0 = Pi_num[3];
+ for (int itab = 1; itab < tables.size() && (config.terms & TERM_SHEAR); itab++) {
+  cout << "scan: shear term with coefficient table " << tables[itab] << endl;
+  par.spline = loadCoefficientSpline(tables[itab]);
+  kernelSums shear;
+  calcGrids(par, TERM_SHEAR, shear, single);
+  scanShear.push_back(shear.num[2]);
+ }
+ freeSurface();
+ delete[] surfF;
+
+ std::cout << "###### doCalculations finished ######\n" << std::endl;
+}
+
+// sets the numerators to the scan point; the factors are also set in
+// config, so that they are recorded with the output
+void setScanPoint(int table, double tuningFactor, double kappaTuningFactor) {
+ if (!config.scanCoefficientFiles.empty())
+  config.coefficientFile = config.scanCoefficientFiles[table];
+ config.tuningFactor = tuningFactor;
+ config.kappaTuningFactor = kappaTuningFactor;
+ for (int i = 0; i < nMom * 4; i++) {
+  Pi_num[2][i] = scanShear[table][i] * tuningFactor;
+  Pi_num[3][i] = scanSpin0[i] * kappaTuningFactor;
+ }
+}
+
+// ---- invariants of the derivatives for mode invariants
+// g_mu_mu g_nu_nu X[mu][nu] Y[mu][nu]
+double contract(const double X[4][4], const double Y[4][4]) {
+ double s = 0.;
+ for (int mu = 0; mu < 4; mu++)
+  for (int nu = 0; nu < 4; nu++) s += X[mu][nu] * Y[mu][nu] * gmumu[mu] * gmumu[nu];
+ return s;
+}
+
+// symmetric / antisymmetric part of hbarC*dbeta, squared
+double invSymm(const element &el) {
+ double d[4][4];
+ for (int mu = 0; mu < 4; mu++)
+  for (int nu = 0; nu < 4; nu++)
+   d[mu][nu] = 0.5 * hbarC * (el.dbeta[mu][nu] + el.dbeta[nu][mu]);
+ return contract(d, d);
+}
+
+double invAsymm(const element &el) {
+ double d[4][4];
+ for (int mu = 0; mu < 4; mu++)
+  for (int nu = 0; nu < 4; nu++)
+   d[mu][nu] = 0.5 * hbarC * (el.dbeta[mu][nu] - el.dbeta[nu][mu]);
+ return contract(d, d);
+}
+
+double invMod(const element &el) {
+ return hbarC * hbarC * contract(el.dbeta, el.dbeta);
+}
+
+// expansion rate d_mu u^mu [1/fm]
+double invTheta(const element &el) {
+ double theta = 0.;
+ for (int mu = 0; mu < 4; mu++) theta += gmumu[mu] * el.dmuCart[mu][mu];
+ return theta;
+}
+
+// sigma_mu_nu sigma^mu_nu [1/fm^2]
+double invSigma2(const element &el) { return contract(el.sigma, el.sigma); }
+
+// antisymmetric part of the velocity derivatives, squared [1/fm^2]
+double invOmega2(const element &el) {
+ double d[4][4];
+ for (int mu = 0; mu < 4; mu++)
+  for (int nu = 0; nu < 4; nu++)
+   d[mu][nu] = 0.5 * (el.dmuCart[mu][nu] - el.dmuCart[nu][mu]);
+ return contract(d, d);
+}
+
+double invT(const element &el) { return el.T; }
+
+// Available invariants. To add one, write its function and add a line
+// here; xmin == xmax selects the range from the data, fields are the
+// FIELD_ flags of the element fields the function reads.
+struct invariantDef {
+ const char *name, *title;
+ double xmin, xmax;
+ double (*calc)(const element &);
+ int fields;
+};
+const invariantDef invariantDefs[] = {
+ {"symm", "symmetric derivatives", 0., 5.0, invSymm, FIELD_DBETA},
+ {"asymm", "Asymmetric derivatives", -1.2, 0.2, invAsymm, FIELD_DBETA},
+ {"mod", "Derivatives", 0., 2.0, invMod, FIELD_DBETA},
+ {"theta", "expansion rate", 0., 0., invTheta, FIELD_DMUCART},
+ {"sigma2", "shear tensor squared", 0., 0., invSigma2, FIELD_DMUCART | FIELD_SIGMA},
+ {"omega2", "velocity vorticity squared", 0., 0., invOmega2, FIELD_DMUCART},
+ {"T", "temperature", 0., 0., invT, 0}};
+const int nInvariantDefs = sizeof(invariantDefs) / sizeof(invariantDefs[0]);
+
+vector<int> selectedInvariants() {
+ vector<int> sel;
+ for (int i = 0; i < config.invariants.size(); i++) {
+  const string &name = config.invariants[i];
+  bool found = false;
+  for (int k = 0; k < nInvariantDefs; k++)
+   if (name == "all" || name == invariantDefs[k].name) {
+    sel.push_back(k);
+    found = true;
+   }
+  if (!found) {
+   cout << "unknown invariant: " << name << endl;
+   exit(1);
+  }
+ }
+ return sel;
+}
+
+// The element fields needed by the configured mode: all polarization terms
+// use dmuCart and the shear term the shear tensor; the invariants list
+// their fields in invariantDefs.
+int surfaceFields() {
+ if (config.mode == MODE_INVARIANTS) {
+  const vector<int> sel = selectedInvariants();
+  int fields = 0;
+  for (int i = 0; i < sel.size(); i++) fields |= invariantDefs[sel[i]].fields;
+  return fields;
+ }
+ return FIELD_DMUCART | ((config.terms & TERM_SHEAR) ? FIELD_SIGMA : 0);
+}
+
+// elements which enter the histograms
+inline bool invariantCut(const element &el) { return fabs(el.eta) < 0.5; }
+
+// Histograms of invariant combinations of the derivatives over the elements
+// with |eta| < 0.5. Each thread fills its own histograms, they are summed at
+// the end and written to out_file (text, or binary for .bin / output_format
+// binary); with plots 1 they are also drawn with ROOT.
+void calcInvariantQuantities(char *out_file) {
+ const vector<int> sel = selectedInvariants();
+ const int n = sel.size();
+ // data ranges, for the invariants without a fixed range
+ vector<double> xmin(n, 1e300), xmax(n, -1e300);
+ setElementSchedule();
+ #pragma omp parallel
+ {
+  vector<double> tmin(n, 1e300), tmax(n, -1e300);
+  #pragma omp for schedule(runtime) nowait
+  for (int iel = 0; iel < Nelem; iel++) {
+   if (!invariantCut(surf[iel])) continue;
+   for (int k = 0; k < n; k++) {
+    const invariantDef &inv = invariantDefs[sel[k]];
+    if (inv.xmin != inv.xmax) continue;
+    const double x = inv.calc(surf[iel]);
+    tmin[k] = min(tmin[k], x);
+    tmax[k] = max(tmax[k], x);
+   }
+  }
+  #pragma omp critical
+  for (int k = 0; k < n; k++) {
+   xmin[k] = min(xmin[k], tmin[k]);
+   xmax[k] = max(xmax[k], tmax[k]);
+  }
+ }
+ vector<Histogram> hists;
+ vector<string> names;
+ for (int k = 0; k < n; k++) {
+  const invariantDef &inv = invariantDefs[sel[k]];
+  double lo = inv.xmin, hi = inv.xmax;
+  if (lo == hi) {
+   lo = xmin[k] < xmax[k] ? xmin[k] : xmin[k] - 0.5;
+   hi = xmin[k] < xmax[k] ? xmax[k] + 1e-9 * (xmax[k] - xmin[k]) : xmin[k] + 0.5;
+   if (xmin[k] > xmax[k]) lo = 0., hi = 1.;  // no elements
+  }
+  hists.push_back(Histogram(config.nBins, lo, hi));
+  names.push_back(inv.name);
+ }
+ const vector<Histogram> empty(hists);
+ int nBadElem = 0, nCut = 0;
+ #pragma omp parallel reduction(+ : nBadElem, nCut)
+ {
+  vector<Histogram> local(empty);
+  #pragma omp for schedule(runtime) nowait
+  for (int iel = 0; iel < Nelem; iel++) {  // loop over all elements
+   if (surf[iel].flags & ELEM_BAD_DBETA) nBadElem++;
+   if (!invariantCut(surf[iel])) continue;
+   nCut++;
+   for (int k = 0; k < n; k++) local[k].fill(invariantDefs[sel[k]].calc(surf[iel]));
+  }
+  #pragma omp critical
+  for (int k = 0; k < n; k++) hists[k].add(local[k]);
+ }
+ cout << "calcInvariantQuantities: elements " << Nelem << ", with |eta|<0.5 "
+      << nCut << ", bad " << nBadElem << endl;
+ for (int k = 0; k < n; k++)
+  cout << "  " << setw(8) << names[k] << " [" << hists[k].xMin << ", "
+       << hists[k].xMax << "): underflow " << hists[k].underflow << ", overflow "
+       << hists[k].overflow << ", nan " << hists[k].nNan << endl;
+ if (config.outputFormat == "binary" ||
+     (config.outputFormat == "auto" && isBinaryOutput(out_file)))
+  writeHistogramsBinary(out_file, names, hists);
+ else
+  writeHistogramsText(out_file, names, hists);
+#ifndef HEADLESS
+ if (config.plots) {
+  for (int k = 0; k < n; k++) {
+   const string cname = "plot_" + names[k], hname = "hist_" + names[k];
+   TCanvas *canvas = new TCanvas(cname.c_str(), invariantDefs[sel[k]].title);
+   TH1D *hist = new TH1D(hname.c_str(), hname.c_str(), hists[k].nBins,
+                         hists[k].xMin, hists[k].xMax);
+   for (int i = 0; i < hists[k].nBins; i++)
+    hist->SetBinContent(i + 1, hists[k].density(i));
+   canvas->cd();
+   hist->Draw("H");
+  }
+ }
+#endif
 }
 
 void calcEP1() {
@@ -448,8 +2101,8 @@ void calcEP1() {
  const double pT = 1.0;
  int nFFail = 0;
  for (int iel = 0; iel < Nelem; iel++) {  // loop over all elements
-  if(fabs(surf[iel].dbeta[0][0])>1000.0) nBadElem++;
-  //if(fabs(surf[iel].dbeta[0][0])>1000.0) continue;
+  if (surf[iel].flags & ELEM_BAD_DBETA) nBadElem++;
+  //if (surf[iel].flags & ELEM_BAD_DBETA) continue;
   for (int iphi = 0; iphi < phi.size(); iphi++) {
    double mT = sqrt(mass * mass + pT * pT);
    const double sin_phi = sin(phi[iphi]);
@@ -472,29 +2125,241 @@ void calcEP1() {
    Qy2 += p2[2] * pds2 * f2;
   }
  }  // loop over all elements
+#ifdef USE_MPI
+ double Q[4] = {Qx1, Qy1, Qx2, Qy2};
+ MPI_Allreduce(MPI_IN_PLACE, Q, 4, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+ Qx1 = Q[0]; Qy1 = Q[1]; Qx2 = Q[2]; Qy2 = Q[3];
+#endif
  cout << "EP1_vectors: " << Qx1 << "  " << Qy1 << "  "
    << Qx2 << "  " << Qy2 << endl;
  cout << "EP_angles: " << atan2(Qy1, Qx1) << "  " << atan2(Qy2, Qx2) << endl;
 }
 
+// normalization of the numerator grid of term it in the output
+double termNorm(int it) {
+ const double mass = particle->GetMass();
+ switch (1 << it) {
+  case TERM_STANDARD: return hbarC / (8.0 * mass);
+  case TERM_XI: return - hbarC / (8.0 * mass);
+  case TERM_SHEAR: return - hbarC / 2.0;
+  case TERM_SPIN0: return - hbarC / 4.0;
+ }
+ return 0.;
+}
+
+// indices (0...nTerms-1) of the terms selected in the configuration
+vector<int> activeTerms() {
+ vector<int> active;
+ for (int it = 0; it < nTerms; it++)
+  if (config.terms & (1 << it)) active.push_back(it);
+ return active;
+}
+
+// Boosts the mean spin vectors to the rest frame of the particle and divides
+// by the spin and dN/dpt, giving the polarization P* of Eq. 12 in
+// arXiv:1610.04717 for each enabled term and their sum.
+// Also writes the pT-integrated P_z(phi), P_J(phi) and their harmonics,
+// replacing the corresponding pass in output/showPolar-xi.py; the integrals
+// use the quadrature weights wPt, wPhi of the grid.
+void calcRestFrame(char *out_file) {
+ const double mass = particle->GetMass();
+ const double spinFactor = particle->GetSpin() > 0. ? 1. / particle->GetSpin() : 1.;
+ const vector<int> active = activeTerms();
+ const int nSets = active.size() + 1;  // enabled terms + total
+ const int nPt = pT.size(), nPhi = phi.size();
+ nPstar = 3 * nSets;
+ Pstar.assign(nPt * nPhi * nPstar, 0.0);
+ // yield-weighted sums over the pT range: [phi][term][z or J], dN[phi]
+ vector<double> sumS(nPhi * nSets * 2, 0.0), sumN(nPhi, 0.0);
+ for (int ipt = 0; ipt < nPt; ipt++) {
+  const double e = sqrt(mass * mass + pT[ipt] * pT[ipt]);
+  const bool inRange = pT[ipt] > config.ptMinInt && pT[ipt] < config.ptMaxInt;
+  for (int iphi = 0; iphi < nPhi; iphi++) {
+   const double p[3] = {pT[ipt] * cos(phi[iphi]), pT[ipt] * sin(phi[iphi]), 0.};
+   const double dN = Pi_den[ipt * nPhi + iphi];
+   double *P = &Pstar[(ipt * nPhi + iphi) * nPstar];
+   double *sum = &sumS[iphi * nSets * 2];
+   for (int k = 0; k < nSets - 1; k++) {
+    const double *num = &Pi_num[active[k]][(ipt * nPhi + iphi) * 4];
+    double S[3];
+    for (int i = 0; i < 3; i++) S[i] = termNorm(active[k]) * num[i + 1];
+    const double Sp = S[0] * p[0] + S[1] * p[1] + S[2] * p[2];
+    for (int i = 0; i < 3; i++) {
+     const double Sstar = S[i] - Sp / (e * (e + mass)) * p[i];
+     P[3 * k + i] = spinFactor * Sstar / dN;
+     P[nPstar - 3 + i] += P[3 * k + i];
+     if (inRange) {
+      // P^z and P_J = -P^y, weighted with pT dpT for the integral over pT
+      if (i == 2) sum[2 * k] += Sstar * pT[ipt] * wPt[ipt];
+      if (i == 1) sum[2 * k + 1] -= Sstar * pT[ipt] * wPt[ipt];
+     }
+    }
+   }
+   if (inRange) sumN[iphi] += dN * pT[ipt] * wPt[ipt];
+  }
+ }
+ double totalN = 0.;
+ for (int iphi = 0; iphi < nPhi; iphi++) {
+  totalN += sumN[iphi] * wPhi[iphi];
+  double *sum = &sumS[iphi * nSets * 2];
+  for (int zj = 0; zj < 2; zj++) {
+   sum[2 * (nSets - 1) + zj] = 0.;
+   for (int k = 0; k < nSets - 1; k++) sum[2 * (nSets - 1) + zj] += sum[2 * k + zj];
+  }
+ }
+ char int_file[200];
+ strcpy(int_file, out_file);
+ strcat(int_file, ".integrated");
+ ofstream fint(int_file);
+ if (!fint) {
+  cout << "I/O error with " << int_file << endl;
+  exit(1);
+ }
+ string sets;
+ for (int k = 0; k < nSets - 1; k++) sets += string(termName(1 << active[k])) + " ";
+ sets += "total";
+ fint << "# " << config.ptMinInt << " < pT < " << config.ptMaxInt << endl;
+ fint << "# phi  P_z(" << sets << ")  P_J(" << sets << ")" << endl;
+ for (int iphi = 0; iphi < nPhi; iphi++) {
+  fint << setw(14) << phi[iphi];
+  for (int zj = 0; zj < 2; zj++)
+   for (int k = 0; k < nSets; k++)
+    fint << setw(14) << spinFactor * sumS[(iphi * nSets + k) * 2 + zj] / sumN[iphi];
+  fint << endl;
+ }
+ fint.close();
+ strcpy(int_file, out_file);
+ strcat(int_file, ".harmonics");
+ ofstream fharm(int_file);
+ if (!fharm) {
+  cout << "I/O error with " << int_file << endl;
+  exit(1);
+ }
+ fharm << "# " << config.ptMinInt << " < pT < " << config.ptMaxInt
+       << ", yield-weighted averages; n=0 gives the mean P_z and P_J" << endl;
+ fharm << "# n  for " << sets << ": <P_z cos(n phi)> <P_z sin(n phi)>"
+       << " <P_J cos(n phi)> <P_J sin(n phi)>" << endl;
+ for (int n = 0; n <= nHarmonics; n++) {
+  fharm << setw(4) << n;
+  for (int k = 0; k < nSets; k++)
+   for (int zj = 0; zj < 2; zj++) {
+    double c = 0., s = 0.;
+    for (int iphi = 0; iphi < nPhi; iphi++) {
+     c += sumS[(iphi * nSets + k) * 2 + zj] * cos(n * phi[iphi]) * wPhi[iphi];
+     s += sumS[(iphi * nSets + k) * 2 + zj] * sin(n * phi[iphi]) * wPhi[iphi];
+    }
+    fharm << setw(14) << spinFactor * c / totalN << setw(14) << spinFactor * s / totalN;
+   }
+  fharm << endl;
+ }
+ fharm.close();
+ double PJ = 0.;
+ for (int iphi = 0; iphi < nPhi; iphi++)
+  PJ += sumS[(iphi * nSets + nSets - 1) * 2 + 1] * wPhi[iphi];
+ cout << "global polarization P_J = " << spinFactor * PJ / totalN << endl;
+}
+
+// Mode global: the yield and the polarization integrated over the nodes of
+// initGlobalGrid, in each rapidity bin and over all bins. P^mu is the
+// yield-weighted mean spin vector over the spin in the lab frame, P* the same
+// with the spin vector boosted to the rest frame of the particle at each node
+// (as in calcRestFrame), for each enabled term and their sum. Written as text
+// to out_file; the yield is per spin state.
+void outputGlobal(char *out_file) {
+ const double mass = particle->GetMass();
+ const double spinFactor = particle->GetSpin() > 0. ? 1. / particle->GetSpin() : 1.;
+ const vector<int> active = activeTerms();
+ const int nSets = active.size() + 1;  // enabled terms + total
+ const int nBins = config.globalYBins.size() - 1;
+ const int nPtPhi = pT.size() * phi.size();
+ // per bin and for all bins (last row): yield, then for each set P^mu, P*
+ const int nCol = 1 + 7 * nSets;
+ vector<double> sums((nBins + 1) * nCol, 0.0), add(nCol);
+ for (int ip = 0; ip < nMom; ip++) {
+  const double w = quadWeight[ip];
+  const double *p = &pGrid[ip * 4];
+  double *rows[2] = {&sums[yBin[ip / nPtPhi] * nCol], &sums[nBins * nCol]};
+  add.assign(nCol, 0.);
+  add[0] = w * Pi_den[ip];
+  double *total = &add[1 + 7 * (nSets - 1)];
+  for (int k = 0; k < nSets - 1; k++) {
+   double S[4];
+   for (int mu = 0; mu < 4; mu++)
+    S[mu] = w * termNorm(active[k]) * Pi_num[active[k]][ip * 4 + mu];
+   const double Sp = S[1] * p[1] + S[2] * p[2] + S[3] * p[3];
+   double *set = &add[1 + 7 * k];
+   for (int mu = 0; mu < 4; mu++) set[mu] = S[mu];
+   for (int i = 0; i < 3; i++)
+    set[4 + i] = S[i + 1] - Sp / (p[0] * (p[0] + mass)) * p[i + 1];
+   for (int j = 0; j < 7; j++) total[j] += set[j];
+  }
+  for (int r = 0; r < 2; r++)
+   for (int j = 0; j < nCol; j++) rows[r][j] += add[j];
+ }
+ ofstream fout(out_file);
+ if (!fout) {
+  cout << "I/O error with " << out_file << endl;
+  exit(1);
+ }
+ string sets;
+ for (int k = 0; k < nSets - 1; k++) sets += string(termName(1 << active[k])) + " ";
+ sets += "total";
+ fout << "# " << particle->GetName() << ", " << config.ptMinInt << " < pT < "
+      << config.ptMaxInt << ", nodes pT x phi x y: " << pT.size() << " x " << phi.size()
+      << " x " << config.globalNY << " per bin; last line: all bins" << endl;
+ fout << "# y_min  y_max  dN/dy  for " << sets << ": P^0 P^1 P^2 P^3 P*^x P*^y P*^z" << endl;
+ for (int ib = 0; ib <= nBins; ib++) {
+  const double y0 = config.globalYBins[ib < nBins ? ib : 0];
+  const double y1 = config.globalYBins[ib < nBins ? ib + 1 : nBins];
+  const double *row = &sums[ib * nCol];
+  fout << setw(14) << y0 << setw(14) << y1 << setw(14) << row[0] / (y1 - y0);
+  for (int j = 1; j < nCol; j++) fout << setw(14) << spinFactor * row[j] / row[0];
+  fout << endl;
+ }
+ fout.close();
+ const double *all = &sums[nBins * nCol];
+ cout << "global polarization P_J = " << -spinFactor * all[1 + 7 * (nSets - 1) + 5] / all[0]
+      << ", dN/dy = " << all[0] / (config.globalYBins[nBins] - config.globalYBins[0])
+      << " (" << config.globalYBins[0] << " < y < " << config.globalYBins[nBins] << ")"
+      << endl;
+}
+
+// binary output is selected by the ".bin" extension of the output file
+bool isBinaryOutput(const char *filename) {
+ const int len = strlen(filename);
+ return len > 4 && strcmp(filename + len - 4, ".bin") == 0;
+}
+
+void writeOutput(char *out_file) {
+ if (config.harmonics > 0)
+  outputHarmonics(out_file);
+ else if (config.outputFormat == "binary" ||
+     (config.outputFormat == "auto" && isBinaryOutput(out_file)))
+  outputPolarizationBinary(out_file);
+ else
+  outputPolarization(out_file);
+}
+
 void outputPolarization(char *out_file) {
  ofstream fout(out_file);
  if (!fout) {
   cout << "I/O error with " << out_file << endl;
   exit(1);
  }
+ if (config.restFrame) calcRestFrame(out_file);
+ const vector<int> active = activeTerms();
  for (int ipt = 0; ipt < pT.size(); ipt++)
   for (int iphi = 0; iphi < phi.size(); iphi++) {
     fout << setw(14) << pT[ipt] << setw(14) << phi[iphi]
-       << setw(14) << Pi_den[ipt][iphi];
-    for(int mu=0; mu<4; mu++)
-      fout << setw(14) << Pi_num[ipt][iphi][mu] * hbarC / (8.0 * particle->GetMass());
-    // for(int mu=0; mu<4; mu++)
-    //   fout << setw(14) << - Pi_num_xi[ipt][iphi][mu] * hbarC / (8.0 * particle->GetMass());
-    for(int mu=0; mu<4; mu++)
-      fout << setw(14) << - Pi_num_navierstokes[ipt][iphi][mu] * hbarC / 2.0;
-    // for(int mu=0; mu<4; mu++)
-    //   fout << setw(14) << - Pi_num_spin_potential_zero[ipt][iphi][mu] * hbarC / 4.0;
+       << setw(14) << Pi_den[ipt * phi.size() + iphi];
+    // numerators of the enabled terms, in the order standard, xi, shear, spin0
+    for (int k = 0; k < active.size(); k++)
+     for(int mu=0; mu<4; mu++)
+      fout << setw(14) << Pi_num[active[k]][(ipt * phi.size() + iphi) * 4 + mu] * termNorm(active[k]);
+    // rest frame polarization: P* of each enabled term and the total (x,y,z)
+    if (config.restFrame)
+     for (int i = 0; i < nPstar; i++)
+      fout << setw(14) << Pstar[(ipt * phi.size() + iphi) * nPstar + i];
     fout << endl;
  }
  fout.close();
@@ -504,6 +2369,221 @@ void outputPolarization(char *out_file) {
  ofstream fdim(dim_file);
  fdim << pT.size() << "  " << phi.size() << endl;
  fdim.close();
+ // quadrature weights of the grid: the pT nodes, then the phi nodes
+ strcpy(dim_file, out_file);
+ strcat(dim_file, ".weights");
+ ofstream fw(dim_file);
+ fw << "# pt_grid " << config.ptGrid << ": pT, weight of dpT" << endl;
+ fw << setprecision(17);
+ for (int ipt = 0; ipt < pT.size(); ipt++) fw << pT[ipt] << "  " << wPt[ipt] << endl;
+ fw << "# phi, weight of dphi" << endl;
+ for (int iphi = 0; iphi < phi.size(); iphi++) fw << phi[iphi] << "  " << wPhi[iphi] << endl;
+ fw.close();
+}
+
+// helper for the binary output: appends raw bytes of a value to the buffer
+template <class T> void appendRaw(string &buf, const T &value) {
+ buf.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+// Header text of the binary output: the species, the axes given in 'grid',
+// the components with their normalization factors, the parameters and the
+// provenance.
+string binaryHeader(const string &grid, const vector<string> &compNames,
+                    const vector<double> &norm) {
+ const time_t now = time(0);
+ char timeStamp[64];
+ strftime(timeStamp, sizeof(timeStamp), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+ ostringstream header;
+ header << setprecision(17);
+ header << "species " << particle->GetName() << "\n";
+ header << "pid " << particle->GetPDG() << "\n";
+ header << "mass " << particle->GetMass() << "\n";
+ header << grid;
+ header << "components";
+ for (int i = 0; i < compNames.size(); i++) header << " " << compNames[i];
+ header << "\n";
+ header << "norm";
+ for (int i = 0; i < norm.size(); i++) header << " " << norm[i];
+ header << "\n";
+ header << "tuning_factor " << config.tuningFactor << "\n";
+ header << "kappa_tuning_factor " << config.kappaTuningFactor << "\n";
+ header << "coefficient_file " << config.coefficientFile << "\n";
+ header << "precision " << config.precision << "\n";
+ if (config.boostInvariant)
+  header << "boost_invariant_deta " << config.boostInvariantDeta << "\n";
+ header << "surface " << surfaceName << "\n";
+ header << "created " << timeStamp << "\n";
+ return header.str();
+}
+
+void writeBuffer(char *out_file, const string &buf) {
+ ofstream fout(out_file, ios::out | ios::binary);
+ if (!fout) {
+  cout << "I/O error with " << out_file << endl;
+  exit(1);
+ }
+ fout.write(buf.data(), buf.size());
+ fout.close();
+}
+
+// Self-describing binary version of outputPolarization. Layout:
+//   char[8] "PCALCBIN", uint32 version, uint32 header length,
+//   ASCII header ("key value" lines: species, grid dims, quadrature weights,
+//   component names, normalization factors, provenance),
+//   double pT[nPt], double phi[nPhi], double data[nPt][nPhi][nComp].
+// The normalization factors are already applied to the stored data; they are
+// recorded so that the raw integrals can be recovered. The whole file is
+// assembled in memory and written with one call. Reader: output/readPolar.py
+void outputPolarizationBinary(char *out_file) {
+ if (config.restFrame) calcRestFrame(out_file);
+ const vector<int> active = activeTerms();
+ const char *axis[3] = {"x", "y", "z"};
+ vector<string> compNames;
+ vector<double> norm;
+ compNames.push_back("dN/dpt");
+ norm.push_back(1.0);
+ for (int k = 0; k < active.size(); k++)
+  for (int mu = 0; mu < 4; mu++) {
+   compNames.push_back(string(termLabel[active[k]]) + "^" + char('0' + mu));
+   norm.push_back(termNorm(active[k]));
+  }
+ if (config.restFrame) {
+  for (int k = 0; k <= active.size(); k++)
+   for (int i = 0; i < 3; i++) {
+    compNames.push_back((k < active.size() ? "P*_" + string(termName(1 << active[k]))
+                                           : string("P*_total")) + "^" + axis[i]);
+    norm.push_back(1.0);
+   }
+ }
+ const int nComp = compNames.size();
+ ostringstream grid;
+ grid << setprecision(17);
+ grid << "axes pT phi\n";
+ grid << "dims " << pT.size() << " " << phi.size() << "\n";
+ // quadrature weights of the integrals over pT and phi, see ptNodes
+ grid << "pt_grid " << config.ptGrid << "\n";
+ grid << "weights_pt";
+ for (int ipt = 0; ipt < pT.size(); ipt++) grid << " " << wPt[ipt];
+ grid << "\n";
+ grid << "weights_phi";
+ for (int iphi = 0; iphi < phi.size(); iphi++) grid << " " << wPhi[iphi];
+ grid << "\n";
+ const string headerText = binaryHeader(grid.str(), compNames, norm);
+
+ string buf;
+ buf.reserve(16 + headerText.size() +
+             sizeof(double) * (pT.size() + phi.size() * (1 + pT.size() * nComp)));
+ buf.append("PCALCBIN", 8);
+ appendRaw(buf, (unsigned int)1);
+ appendRaw(buf, (unsigned int)headerText.size());
+ buf.append(headerText);
+ for (int ipt = 0; ipt < pT.size(); ipt++) appendRaw(buf, pT[ipt]);
+ for (int iphi = 0; iphi < phi.size(); iphi++) appendRaw(buf, phi[iphi]);
+ for (int ipt = 0; ipt < pT.size(); ipt++)
+  for (int iphi = 0; iphi < phi.size(); iphi++) {
+   appendRaw(buf, Pi_den[ipt * phi.size() + iphi] * norm[0]);
+   for (int k = 0; k < active.size(); k++)
+    for (int mu = 0; mu < 4; mu++)
+     appendRaw(buf, Pi_num[active[k]][(ipt * phi.size() + iphi) * 4 + mu] * norm[1 + 4 * k + mu]);
+   if (config.restFrame)
+    for (int i = 0; i < nPstar; i++)
+     appendRaw(buf, Pstar[(ipt * phi.size() + iphi) * nPstar + i]);
+  }
+ writeBuffer(out_file, buf);
+}
+
+// Fourier moments of the grids in phi for each pT (parameter harmonics):
+// c_n = 1/(2pi) int f cos(n phi) dphi and s_n with sin(n phi), n = 0...N,
+// with the phi weights. For the uniform phi grid they are exact up to the
+// aliasing of the harmonics n_phi - n and above. The components are dN/dpt
+// and the numerators of the enabled terms (times termNorm), so that e.g.
+// v_n = c_n/c_0 of dN/dpt and <P^mu cos(n phi)> = c_n of s^mu / c_0 of
+// dN/dpt. Returns [(ipt*(N+1) + n)*nComp + 2*comp + (0 cos, 1 sin)].
+vector<double> phiMoments(const vector<int> &active, int nComp) {
+ const int N = config.harmonics, nPhi = phi.size();
+ vector<double> moments(pT.size() * (N + 1) * nComp, 0.0);
+ for (int n = 0; n <= N; n++)
+  for (int iphi = 0; iphi < nPhi; iphi++) {
+   const double c = cos(n * phi[iphi]) * wPhi[iphi] / (2.0 * M_PI);
+   const double s = sin(n * phi[iphi]) * wPhi[iphi] / (2.0 * M_PI);
+   for (int ipt = 0; ipt < pT.size(); ipt++) {
+    double *m = &moments[(ipt * (N + 1) + n) * nComp];
+    const int ip = ipt * nPhi + iphi;
+    m[0] += c * Pi_den[ip];
+    m[1] += s * Pi_den[ip];
+    for (int k = 0; k < active.size(); k++)
+     for (int mu = 0; mu < 4; mu++) {
+      const double f = Pi_num[active[k]][ip * 4 + mu] * termNorm(active[k]);
+      m[2 * (1 + 4 * k + mu)] += c * f;
+      m[2 * (1 + 4 * k + mu) + 1] += s * f;
+     }
+   }
+  }
+ return moments;
+}
+
+// Output with harmonics > 0: the moments of phiMoments instead of the phi
+// grid, one line per pT and n (text, with a header line) or in the binary
+// format with the axes pT and n. With restframe, the integrated files of
+// calcRestFrame are written as well.
+void outputHarmonics(char *out_file) {
+ if (config.restFrame) calcRestFrame(out_file);
+ const vector<int> active = activeTerms();
+ const int N = config.harmonics;
+ vector<string> names;
+ names.push_back("dN/dpt");
+ for (int k = 0; k < active.size(); k++)
+  for (int mu = 0; mu < 4; mu++)
+   names.push_back(string(termLabel[active[k]]) + "^" + char('0' + mu));
+ const int nComp = 2 * names.size();
+ const vector<double> moments = phiMoments(active, nComp);
+ if (config.outputFormat == "binary" ||
+     (config.outputFormat == "auto" && isBinaryOutput(out_file))) {
+  vector<string> compNames;
+  for (int i = 0; i < names.size(); i++) {
+   compNames.push_back(names[i] + "_cos");
+   compNames.push_back(names[i] + "_sin");
+  }
+  // the moments are stored with termNorm applied
+  const vector<double> norm(nComp, 1.0);
+  ostringstream grid;
+  grid << setprecision(17);
+  grid << "axes pT n\n";
+  grid << "dims " << pT.size() << " " << N + 1 << "\n";
+  grid << "harmonics " << N << " of " << phi.size() << " phi points\n";
+  grid << "pt_grid " << config.ptGrid << "\n";
+  grid << "weights_pt";
+  for (int ipt = 0; ipt < pT.size(); ipt++) grid << " " << wPt[ipt];
+  grid << "\n";
+  const string headerText = binaryHeader(grid.str(), compNames, norm);
+  string buf;
+  buf.append("PCALCBIN", 8);
+  appendRaw(buf, (unsigned int)1);
+  appendRaw(buf, (unsigned int)headerText.size());
+  buf.append(headerText);
+  for (int ipt = 0; ipt < pT.size(); ipt++) appendRaw(buf, pT[ipt]);
+  for (int n = 0; n <= N; n++) appendRaw(buf, (double)n);
+  for (int i = 0; i < moments.size(); i++) appendRaw(buf, moments[i]);
+  writeBuffer(out_file, buf);
+  return;
+ }
+ ofstream fout(out_file);
+ if (!fout) {
+  cout << "I/O error with " << out_file << endl;
+  exit(1);
+ }
+ fout << "# pT  n";
+ for (int i = 0; i < names.size(); i++) fout << "  c_n(" << names[i] << ") s_n(" << names[i] << ")";
+ fout << endl;
+ for (int ipt = 0; ipt < pT.size(); ipt++)
+  for (int n = 0; n <= N; n++) {
+   fout << setw(14) << pT[ipt] << setw(4) << n;
+   for (int i = 0; i < nComp; i++)
+    fout << setw(14) << moments[(ipt * (N + 1) + n) * nComp + i];
+   fout << endl;
+  }
+ fout.close();
 }
 
 }  // end namespace gen
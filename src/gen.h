@@ -1,22 +1,61 @@
+#include <string>
+#include <vector>
+
 class TRandom3;
 class DatabasePDG2;
 class Particle;
 struct element;
 
-//#define PLOTS
-
 namespace gen {
 // typedef std::vector<Particle*> ParticleList ; // TODO in far future
 // data
 extern DatabasePDG2 *database;
 extern TRandom3 *rnd;
+// momentum grid and the results: denominator [ip] and numerators
+// [ip*4 + mu] of Eq. 34 for the terms, ip = ipt*phi.size() + iphi
+extern std::vector<double> pT, phi;
+// quadrature weights of the integrals over pT and phi at the grid points
+extern std::vector<double> wPt, wPhi;
+extern std::vector<double> Pi_den;
+extern std::vector<double> Pi_num[];
 
 // functions
-void load(char *filename, int N);
+// the surface is loaded with the element fields given by surfaceFields
+int surfaceFields();
+void load(char *filename, int N, int fields);
+void loadSlice(char *filename, int slice, int nSlices, int fields);
+void selectEtaSlice();
 void initCalc(void);
 double shear_tensor(const element* surf_element, int mu, int nu);
 void doCalculations(int pid = 3122);
+// follow mode: reads and processes the surface while it is written
+void doFollowCalculations(char *filename, int pid);
+// incremental calculation, the surface is added in chunks which are processed
+// one by one. addElementChunk takes n elements of 48 values in the column
+// order of the surface file, stride values apart (see pcalc_element);
+// addFileChunk loads a whole surface file of N lines, see load (with
+// boost_invariant only its eta slice closest to 0, see selectEtaSlice).
+void beginChunks(int pid);
+void addTextChunk(const std::string &text, int n);
+void addElementChunk(const double *values, int n, long stride);
+void addFileChunk(char *filename, int N);
+void finishChunks();
+// parameter scan: doScanCalculations computes the unscaled grids once,
+// setScanPoint scales them to one point of the scan
+void doScanCalculations(int pid);
+int nScanTables();
+void setScanPoint(int table, double tuningFactor, double kappaTuningFactor);
+// factor of the numerators of term it in the polarization
+double termNorm(int it);
+bool isBinaryOutput(const char *filename);
+// binary or text output, from output_format and the file name
+void writeOutput(char *out_file);
 void outputPolarization(char *out_file);
-void calcInvariantQuantities();
+void outputPolarizationBinary(char *out_file);
+// harmonics > 0: Fourier moments in phi of the grids per pT
+void outputHarmonics(char *out_file);
+// mode global: integrated yields and polarization per rapidity bin
+void outputGlobal(char *out_file);
+void calcInvariantQuantities(char *out_file);
 void calcEP1();
 }
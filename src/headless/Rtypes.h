@@ -0,0 +1,18 @@
+#ifndef HEADLESS_RTYPES_H
+#define HEADLESS_RTYPES_H
+
+// The basic ROOT types used by the particle database classes, for the
+// headless build (make HEADLESS=1) without ROOT. With ROOT, its own Rtypes.h
+// is found first.
+typedef char Char_t;
+typedef short Short_t;
+typedef int Int_t;
+typedef unsigned int UInt_t;
+typedef long Long_t;
+typedef float Float_t;
+typedef double Double_t;
+typedef bool Bool_t;
+const Bool_t kFALSE = false;
+const Bool_t kTRUE = true;
+
+#endif // HEADLESS_RTYPES_H
@@ -0,0 +1,86 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+
+#include "histogram.h"
+
+using namespace std;
+
+Histogram::Histogram(int _nBins, double _xMin, double _xMax)
+    : nBins(_nBins > 0 ? _nBins : 1),
+      xMin(_xMin),
+      xMax(_xMax),
+      bins(nBins, 0.),
+      underflow(0.),
+      overflow(0.),
+      nNan(0.) {}
+
+void Histogram::add(const Histogram &h) {
+ for (int i = 0; i < nBins; i++) bins[i] += h.bins[i];
+ underflow += h.underflow;
+ overflow += h.overflow;
+ nNan += h.nNan;
+}
+
+double Histogram::integral() const {
+ double sum = 0.;
+ for (int i = 0; i < nBins; i++) sum += bins[i];
+ return sum;
+}
+
+double Histogram::density(int i) const {
+ const double norm = integral() * width();
+ return norm > 0. ? bins[i] / norm : 0.;
+}
+
+// one header line per histogram, shared by both formats
+string histogramHeader(const string &name, const Histogram &h) {
+ ostringstream line;
+ line << setprecision(17) << name << " " << h.nBins << " " << h.xMin << " "
+      << h.xMax << " " << h.integral() << " " << h.underflow << " "
+      << h.overflow << " " << h.nNan;
+ return line.str();
+}
+
+void writeHistogramsText(const char *filename, const vector<string> &names,
+                         const vector<Histogram> &hists) {
+ ofstream fout(filename);
+ if (!fout) {
+  cout << "cannot open file " << filename << endl;
+  exit(1);
+ }
+ fout << "# name nbins xmin xmax entries underflow overflow nan\n";
+ for (int k = 0; k < hists.size(); k++) {
+  const Histogram &h = hists[k];
+  fout << "# " << histogramHeader(names[k], h) << "\n";
+  for (int i = 0; i < h.nBins; i++)
+   fout << setw(14) << h.center(i) << setw(14) << h.density(i) << setw(14)
+        << h.bins[i] << "\n";
+  fout << "\n\n";  // gnuplot index separator
+ }
+}
+
+void writeHistogramsBinary(const char *filename, const vector<string> &names,
+                           const vector<Histogram> &hists) {
+ string header;
+ for (int k = 0; k < hists.size(); k++)
+  header += histogramHeader(names[k], hists[k]) + "\n";
+ const unsigned int version = 1, hlen = header.size();
+ ofstream fout(filename, ios::out | ios::binary);
+ if (!fout) {
+  cout << "cannot open file " << filename << endl;
+  exit(1);
+ }
+ fout.write("PCALCHST", 8);
+ fout.write((const char *)&version, sizeof(version));
+ fout.write((const char *)&hlen, sizeof(hlen));
+ fout.write(header.data(), hlen);
+ for (int k = 0; k < hists.size(); k++) {
+  vector<double> d(hists[k].nBins);
+  for (int i = 0; i < hists[k].nBins; i++) d[i] = hists[k].density(i);
+  fout.write((const char *)&d[0], d.size() * sizeof(double));
+ }
+}
@@ -0,0 +1,45 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <string>
+#include <vector>
+
+// Fixed binning histogram without ROOT. Each thread fills its own copy,
+// the copies are summed with add(). Entries outside [xMin, xMax) go to the
+// underflow/overflow counters, NaN entries are counted separately.
+class Histogram {
+public:
+ int nBins;
+ double xMin, xMax;
+ std::vector<double> bins;
+ double underflow, overflow, nNan;
+
+ Histogram(int nBins = 1, double xMin = 0., double xMax = 1.);
+ inline void fill(double x) {
+  if (x != x) nNan++;
+  else if (x < xMin) underflow++;
+  else if (x >= xMax) overflow++;
+  else {
+   const int i = (int)((x - xMin) / (xMax - xMin) * nBins);
+   bins[i < nBins ? i : nBins - 1] += 1.;
+  }
+ }
+ void add(const Histogram &h);
+ double width() const { return (xMax - xMin) / nBins; }
+ double center(int i) const { return xMin + (i + 0.5) * width(); }
+ double integral() const;  // entries in [xMin, xMax)
+ // bin content normalized to unit area (ROOT: Scale(1/Integral(), "width"))
+ double density(int i) const;
+};
+
+// Writes the histograms with their names, either as text blocks
+// ("# name nbins xmin xmax entries underflow overflow nan" followed by
+// "x density count" lines) or in binary: "PCALCHST", uint32 version,
+// uint32 header length, ASCII header with one such line per histogram,
+// then the densities of each histogram in double precision.
+void writeHistogramsText(const char *filename, const std::vector<std::string> &names,
+                         const std::vector<Histogram> &hists);
+void writeHistogramsBinary(const char *filename, const std::vector<std::string> &names,
+                           const std::vector<Histogram> &hists);
+
+#endif // HISTOGRAM_H
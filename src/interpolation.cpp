@@ -21,15 +21,12 @@
 #include <sstream>
 #include <string>
 #include <algorithm> // for std::sort
+#ifndef HEADLESS
 #include <TGraph.h>
-#include <TSpline.h>
 #include <TCanvas.h>
+#endif
 
-// Structure to hold x and y values
-struct DataPoint {
-    double x;
-    double y;
-};
+#include "interpolation.h"
 
 // Function to parse CSV file and extract data points
 std::vector<DataPoint> parseCSV(const std::string& filename) {
@@ -56,6 +53,7 @@ std::vector<DataPoint> parseCSV(const std::string& filename) {
     return dataPoints;
 }
 
+#ifndef HEADLESS
 void plotTGraph(TGraph* graph) {
     // Create a canvas for the plot
     TCanvas* canvas = new TCanvas("canvas", "Graph Plot", 800, 600);
@@ -73,8 +71,84 @@ void plotTGraph(TGraph* graph) {
     // Wait for user input to exit the program
     canvas->WaitPrimitive();
 }
+#endif
+
+// Port of CUBSPL from C. de Boor, "A practical guide to splines", with
+// ibcbeg = ibcend = 0 (not-a-knot), as used by TSpline3. In the notation
+// of CUBSPL, s = c(2,.) are the slopes at the nodes.
+CubicSpline::CubicSpline(const std::vector<DataPoint>& points) {
+    const int n = points.size();
+    x.resize(n);
+    y.resize(n);
+    for (int i = 0; i < n; i++) {
+        x[i] = points[i].x;
+        y[i] = points[i].y;
+    }
+    b.assign(n, 0.0);
+    c.assign(n, 0.0);
+    d.assign(n, 0.0);
+    if (n < 2) return;
+    std::vector<double> s(n), dx(n), dd(n), diag(n);  // c(2..4,.) of CUBSPL
+    for (int m = 1; m < n; m++) {
+        dx[m] = x[m] - x[m - 1];
+        dd[m] = (y[m] - y[m - 1]) / dx[m];
+    }
+    if (n == 2) {
+        b[0] = b[1] = dd[1];
+        return;
+    }
+    // not-a-knot condition at the left end
+    diag[0] = dx[2];
+    dx[0] = dx[1] + dx[2];
+    s[0] = ((dx[1] + 2. * dx[0]) * dd[1] * dx[2] + dx[1] * dx[1] * dd[2]) / dx[0];
+    // forward pass of the Gauss elimination
+    for (int m = 1; m < n - 1; m++) {
+        const double g = -dx[m + 1] / diag[m - 1];
+        s[m] = g * s[m - 1] + 3. * (dx[m] * dd[m + 1] + dx[m + 1] * dd[m]);
+        diag[m] = g * dx[m - 1] + 2. * (dx[m] + dx[m + 1]);
+    }
+    // not-a-knot condition at the right end
+    double g;
+    if (n == 3) {
+        s[n - 1] = 2. * dd[n - 1];
+        diag[n - 1] = 1.;
+        g = -1. / diag[n - 2];
+    } else {
+        g = dx[n - 2] + dx[n - 1];
+        s[n - 1] = ((dx[n - 1] + 2. * g) * dd[n - 1] * dx[n - 2]
+                    + dx[n - 1] * dx[n - 1] * (y[n - 2] - y[n - 3]) / dx[n - 2]) / g;
+        g = -g / diag[n - 2];
+        diag[n - 1] = dx[n - 2];
+    }
+    diag[n - 1] = g * dx[n - 2] + diag[n - 1];
+    s[n - 1] = (g * s[n - 2] + s[n - 1]) / diag[n - 1];
+    // back substitution
+    for (int j = n - 2; j >= 0; j--)
+        s[j] = (s[j] - dx[j] * s[j + 1]) / diag[j];
+    // cubic coefficients of the intervals
+    for (int i = 1; i < n; i++) {
+        const double h = x[i] - x[i - 1];
+        const double divdf1 = (y[i] - y[i - 1]) / h;
+        const double divdf3 = s[i - 1] + s[i] - 2. * divdf1;
+        b[i - 1] = s[i - 1];
+        c[i - 1] = (divdf1 - s[i - 1] - divdf3) / h;
+        d[i - 1] = divdf3 / (h * h);
+    }
+    b[n - 1] = s[n - 1];
+}
+
+double CubicSpline::Eval(double xx) const {
+    const int n = x.size();
+    if (n == 0) return 0.;
+    if (n == 1) return y[0];
+    // interval [x[i], x[i+1]), the first/last one outside the range
+    int i = std::upper_bound(x.begin(), x.end(), xx) - x.begin() - 1;
+    i = std::max(0, std::min(i, n - 2));
+    const double dxx = xx - x[i];
+    return y[i] + dxx * (b[i] + dxx * (c[i] + dxx * d[i]));
+}
 
-TSpline3* performInterpolation(const std::string& filename) {
+CubicSpline* performInterpolation(const std::string& filename) {
     std::vector<DataPoint> dataPoints = parseCSV(filename);
     if (dataPoints.empty()) {
         std::cerr << "No data points found." << std::endl;
@@ -86,24 +160,17 @@ TSpline3* performInterpolation(const std::string& filename) {
         return a.x < b.x;
     });
 
-    size_t numDataPoints = dataPoints.size();
-    TGraph graph(numDataPoints);
-    for (size_t i = 0; i < numDataPoints; ++i) {
-        graph.SetPoint(i, dataPoints[i].x, dataPoints[i].y);
-    }
-    TSpline3* spline = new TSpline3("spline", &graph);
-
-    return spline;
+    return new CubicSpline(dataPoints);
 }
 
-// Function definition for obtaining the TSpline3 object
-TSpline3* getInterpolationSpline(const std::string& filename) {
+// Function definition for obtaining the spline object
+CubicSpline* getInterpolationSpline(const std::string& filename) {
     // Call the function in the interpolation file to perform the interpolation
-    // and return the TSpline3 object
+    // and return the spline object
     return performInterpolation(filename);
 }
 
-void saveTableToFile(const TSpline3* spline, const std::string& filename) {
+void saveTableToFile(const CubicSpline* spline, const std::string& filename) {
     std::ofstream file(filename);
 
     // Generate a table of values between x=0.1 and x=20
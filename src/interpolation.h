@@ -2,17 +2,33 @@
 #define INTERPOLATION_H
 
 #include <string>
-#include "TSpline.h"
+#include <vector>
 
 struct DataPoint {
     double x;
     double y;
 };
 
+// Cubic spline interpolation with not-a-knot end conditions (de Boor's
+// CUBSPL), the same as ROOT's TSpline3 built from a TGraph without end point
+// derivatives. Outside the data range the first/last cubic is extrapolated.
+class CubicSpline {
+public:
+    CubicSpline(const std::vector<DataPoint>& points);  // sorted in x
+    double Eval(double x) const;
+
+private:
+    // on [x[i], x[i+1]): y[i] + dx*(b[i] + dx*(c[i] + dx*d[i]))
+    std::vector<double> x, y, b, c, d;
+};
+
 std::vector<DataPoint> parseCSV(const std::string& filename);
-TSpline3* performInterpolation(const std::string& filename);
-TSpline3* getInterpolationSpline(const std::string& filename);
+CubicSpline* performInterpolation(const std::string& filename);
+CubicSpline* getInterpolationSpline(const std::string& filename);
+void saveTableToFile(const CubicSpline* spline, const std::string& filename);
+#ifndef HEADLESS
+class TGraph;
 void plotTGraph(TGraph* graph);
-void saveTableToFile(const TSpline3* spline, const std::string& filename);
+#endif
 
 #endif // INTERPOLATION_H
\ No newline at end of file
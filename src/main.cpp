@@ -1,38 +1,39 @@
 #include <omp.h>
-#include <TFile.h>
-#include <TGraph.h>
-#include <TMath.h>
-#include <TGraph.h>
-#include <TVector3.h>
-#include <TLorentzVector.h>
-#include <TRandom3.h>
-#include <TH1.h>
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
 #include <math.h>
 #include <iomanip>
 #include <ctime>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <fstream>
-#include <TF1.h>
 #include <sstream>
-#include <TUUID.h>
+#ifndef HEADLESS
 #include <TROOT.h>
 #include <TApplication.h>
 #include <TStyle.h>
+#endif
 
 #include "DatabasePDG2.h"
 #include "gen.h"
 
+#include "config.h"
+#include "affinity.h"
+#include "compression.h"
+
 // ############################################################
-//  execution modes:
-//  1) calculation of polarization
-//     #define PLOTS commented out in src/gen.h
-//  2) plots of invariant combinations of beta derivatives
-//     #define PLOTS UNcommented out in src/gen.h
+//  execution modes (parameter "mode"):
+//  1) polarization: calculation of polarization
+//  2) invariants: histograms of invariant combinations of the derivatives
+//  3) global: polarization integrated over momentum, per rapidity bin
+//  all parameters are listed in params/example.params
 // ############################################################
 
 using namespace std;
 int getNlines(char *filename);
+void writeScan(char *output_file);
 
 int ranseed;
 
@@ -43,16 +44,50 @@ void getranseedcpp_(int *seed) { *seed = ranseed; }
 // ########## MAIN block ##################
 
 int main(int argc, char **argv) {
+ int rank = 0, nRanks = 1;
+#ifdef USE_MPI
+ // distributed mode: every rank processes a slice of the surface, rank 0
+ // collects the grids and writes the output; other ranks stay quiet
+ MPI_Init(&argc, &argv);
+ MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+ MPI_Comm_size(MPI_COMM_WORLD, &nRanks);
+ ofstream nullStream;
+ if (rank > 0) cout.rdbuf(nullStream.rdbuf());
+#endif
  // command-line parameters
- if (argc < 3) {
-  cout << "usage: ./calc <surface_file> <output_file> [PID]\n" << endl;
+ string positional[3];
+ if (readCommandLine(config, argc, argv, positional) < 2) {
+  cout << "usage: ./calc <surface_file> <output_file> [PID] [-params <file>]"
+       << " [-<key> <value> ...]\n"
+       << "  output_file ending with .bin -> self-describing binary format\n"
+       << "  -restframe -> also rest frame polarization and integrated P_z, P_J\n"
+       << "  see params/example.params for the available keys\n"
+       << endl;
   exit(1);
  }
  char surface_file[200], output_file[200];
- strcpy(surface_file, argv[1]);
- strcpy(output_file, argv[2]);
+ strcpy(surface_file, positional[0].c_str());
+ strcpy(output_file, positional[1].c_str());
+ printConfig(config);
+ if (config.compensatedSum && config.kernel != "gemm") {
+  cout << "compensated_sum needs the gemm kernel" << endl;
+  exit(1);
+ }
+ if (config.precision == "validate" && isScan(config)) {
+  cout << "precision validate is not available for parameter scans" << endl;
+  exit(1);
+ }
+ if (!config.scanCoefficientFiles.empty() && !(config.terms & TERM_SHEAR)) {
+  cout << "scan_coefficient_file needs the shear term" << endl;
+  exit(1);
+ }
+ if (config.nThreads > 0) omp_set_num_threads(config.nThreads);
+ if (config.pinThreads) pinThreads();
  //========= particle database init
- DatabasePDG2 *database = new DatabasePDG2("Tb/ptl3.data", "Tb/dky3.mar.data");
+ char particle_table[200], decay_table[200];
+ strcpy(particle_table, config.particleTable.c_str());
+ strcpy(decay_table, config.decayTable.c_str());
+ DatabasePDG2 *database = new DatabasePDG2(particle_table, decay_table);
  database->LoadData();
  //	database->SetMassRange(0.01, 10.0); //-------without PHOTONS
  //	database->SetWidthRange(0., 10.0);
@@ -62,25 +97,67 @@ int main(int argc, char **argv) {
  cout << " pion index = " << database->GetPionIndex() << endl;
  gen::database = database;
 
- #ifdef PLOTS
- TApplication theApp("App", &argc, argv);
- gStyle->SetOptStat(kFALSE);
- #endif
+#ifndef HEADLESS
+ TApplication *theApp = 0;
+ if (config.mode == MODE_INVARIANTS && config.plots) {
+  theApp = new TApplication("App", &argc, argv);
+  gStyle->SetOptStat(kFALSE);
+ }
+#else
+ if (config.plots) {
+  cout << "plots need the ROOT build of calc (make without HEADLESS=1)" << endl;
+  exit(1);
+ }
+#endif
  // ========== generator init
  gen::initCalc();
- gen::load(surface_file, getNlines(surface_file));
- #ifndef PLOTS
- gen::calcEP1();
- if(argc==4){
-  gen::doCalculations(atoi(argv[3]));
+ if (nRanks > 1 && config.mode == MODE_INVARIANTS) {
+  cerr << "only the polarization and global modes can run on several MPI ranks" << endl;
+  exit(1);
  }
- else {
-  gen::doCalculations();
+ if (config.follow && (config.mode != MODE_POLARIZATION || isScan(config)
+     || nRanks > 1 || config.precision == "validate")) {
+  cout << "follow needs the polarization mode on one process, without scan"
+       << " and precision validate" << endl;
+  exit(1);
+ }
+ if (config.mode == MODE_GLOBAL && (isScan(config) || config.restFrame)) {
+  cout << "mode global is not available for parameter scans and restframe" << endl;
+  exit(1);
+ }
+ if (config.boostInvariant && (config.mode != MODE_POLARIZATION || (config.terms & TERM_SPIN0)
+     || config.precision != "double" || nRanks > 1 || config.follow)) {
+  cout << "boost_invariant needs the polarization mode on one process, without the"
+       << " spin0 term, follow and precision float/validate" << endl;
+  exit(1);
+ }
+ // in follow mode the surface is read while it is processed
+ if (!config.follow) {
+  const int fields = gen::surfaceFields();
+  if (nRanks > 1)
+   gen::loadSlice(surface_file, rank, nRanks, fields);
+  else
+   gen::load(surface_file, getNlines(surface_file), fields);
+  if (config.boostInvariant) gen::selectEtaSlice();
+ }
+ if (config.follow) {
+  gen::doFollowCalculations(surface_file, config.pid);
+  gen::writeOutput(output_file);
+ } else if (config.mode == MODE_POLARIZATION && isScan(config)) {
+  gen::calcEP1();
+  gen::doScanCalculations(config.pid);
+  if (rank == 0) writeScan(output_file);
+ } else if (config.mode == MODE_POLARIZATION) {
+  gen::calcEP1();
+  gen::doCalculations(config.pid);
+  if (rank == 0)  // the grids are summed on rank 0
+   gen::writeOutput(output_file);
+ } else if (config.mode == MODE_GLOBAL) {
+  gen::doCalculations(config.pid);
+  if (rank == 0) gen::outputGlobal(output_file);
+ } else {
+  gen::calcInvariantQuantities(output_file);
  }
- gen::outputPolarization(output_file);
- #else
- gen::calcInvariantQuantities();
- #endif
  // ========== trees & files
  time_t start, end;
  time(&start);
@@ -88,25 +165,55 @@ int main(int argc, char **argv) {
  time(&end);
  float diff2 = difftime(end, start);
  cout << "Execution time = " << diff2 << " [sec]" << endl;
- #ifdef PLOTS
- theApp.Run();
- #endif
+#ifndef HEADLESS
+ if (theApp) theApp->Run();
+#endif
+#ifdef USE_MPI
+ MPI_Finalize();
+#endif
  return 0;
 }
 
 // auxiliary function to get the number of lines
+// number of lines of the (possibly compressed) surface file
 int getNlines(char *filename) {
- ifstream fin(filename);
- if (!fin) {
+ const long long nlines = countLines(filename);
+ if (nlines < 0) {
   cout << "getNlines: cannot open file: " << filename << endl;
   exit(1);
  }
- string line;
- int nlines = 0;
- while (fin.good()) {
-  getline(fin, line);
-  nlines++;
- };
- fin.close();
- return nlines - 1;
+ return nlines;
+}
+
+// Writes the output for every point of the parameter scan, to
+// <output>_tf<tuning_factor>_ktf<kappa_tuning_factor>[_table<i>][.bin],
+// and the list of the files with their parameters to <output>.scan
+void writeScan(char *output_file) {
+ vector<double> tf = config.scanTuningFactors, ktf = config.scanKappaTuningFactors;
+ if (tf.empty()) tf.push_back(config.tuningFactor);
+ if (ktf.empty()) ktf.push_back(config.kappaTuningFactor);
+ const int nTables = gen::nScanTables();
+ string base = output_file, ext;
+ if (gen::isBinaryOutput(output_file)) {
+  base.erase(base.size() - 4);
+  ext = ".bin";
+ }
+ const string indexFile = string(output_file) + ".scan";
+ ofstream findex(indexFile.c_str());
+ findex << "# file  table  tuning_factor  kappa_tuning_factor\n";
+ for (int itab = 0; itab < nTables; itab++)
+  for (int i = 0; i < tf.size(); i++)
+   for (int k = 0; k < ktf.size(); k++) {
+    ostringstream name;
+    name << base << "_tf" << tf[i] << "_ktf" << ktf[k];
+    if (nTables > 1) name << "_table" << itab;
+    name << ext;
+    char file[400];
+    strcpy(file, name.str().c_str());
+    gen::setScanPoint(itab, tf[i], ktf[k]);
+    gen::writeOutput(file);
+    findex << file << "  " << itab << "  " << tf[i] << "  " << ktf[k] << endl;
+   }
+ cout << "scan: " << nTables * tf.size() * ktf.size() << " outputs, listed in "
+      << indexFile << endl;
 }
@@ -0,0 +1,172 @@
+#include <omp.h>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "DatabasePDG2.h"
+#include "gen.h"
+#include "config.h"
+#include "affinity.h"
+#include "compression.h"
+#include "pcalc.h"
+
+using namespace std;
+
+// the library interface of pcalc.h, over the incremental calculation of gen
+
+struct pcalc_context {
+ int state;  // STATE_
+ long nElements;
+};
+
+enum { STATE_CREATED, STATE_INITIALIZED, STATE_FINISHED };
+
+static pcalc_context *context = 0;
+
+pcalc_context *pcalc_create(void) {
+ if (context) {
+  cout << "pcalc_create: there can be only one context" << endl;
+  return 0;
+ }
+ context = new pcalc_context;
+ context->state = STATE_CREATED;
+ context->nElements = 0;
+ return context;
+}
+
+void pcalc_destroy(pcalc_context *ctx) {
+ if (ctx != context) return;
+ delete context;
+ context = 0;
+}
+
+int pcalc_set(pcalc_context *ctx, const char *key, const char *value) {
+ if (strcmp(key, "params") == 0) readParams(config, value);
+ else if (!setParam(config, key, value)) {
+  cout << "pcalc_set: unknown parameter " << key << endl;
+  return -1;
+ }
+ return 0;
+}
+
+// the parameters the incremental calculation supports
+bool checkConfig() {
+ if (config.mode != MODE_POLARIZATION || isScan(config) || config.precision == "validate"
+     || (config.compensatedSum && config.kernel != "gemm")) {
+  cout << "pcalc: only the polarization mode, without scan, precision validate and"
+       << " (with a direct kernel) compensated_sum" << endl;
+  return false;
+ }
+ // the elements are one eta slice, its width is not taken from the surface
+ if (config.boostInvariant && ((config.terms & TERM_SPIN0) || config.precision != "double"
+     || config.boostInvariantDeta <= 0.)) {
+  cout << "pcalc: boost_invariant needs boost_invariant_deta, precision double and no"
+       << " spin0 term" << endl;
+  return false;
+ }
+ return true;
+}
+
+int pcalc_init(pcalc_context *ctx) {
+ if (ctx->state != STATE_CREATED || !checkConfig()) return -1;
+ printConfig(config);
+ if (config.nThreads > 0) omp_set_num_threads(config.nThreads);
+ if (config.pinThreads) pinThreads();
+ char particle_table[200], decay_table[200];
+ strcpy(particle_table, config.particleTable.c_str());
+ strcpy(decay_table, config.decayTable.c_str());
+ delete gen::database;  // from an earlier context
+ DatabasePDG2 *database = new DatabasePDG2(particle_table, decay_table);
+ database->LoadData();
+ database->SortParticlesByMass();
+ database->CorrectBranching();
+ gen::database = database;
+ gen::initCalc();
+ gen::beginChunks(config.pid);
+ ctx->state = STATE_INITIALIZED;
+ return 0;
+}
+
+int pcalc_add_elements(pcalc_context *ctx, const double *values, size_t n,
+                       size_t stride) {
+ if (ctx->state != STATE_INITIALIZED) return -1;
+ if (stride == 0) stride = sizeof(pcalc_element) / sizeof(double);
+ // the surface arrays of gen are indexed with int
+ const size_t maxChunk = 1 << 26;
+ for (size_t first = 0; first < n; first += maxChunk) {
+  const int nChunk = min(n - first, maxChunk);
+  gen::addElementChunk(values + first * stride, nChunk, stride);
+ }
+ ctx->nElements += n;
+ return 0;
+}
+
+int pcalc_add_file(pcalc_context *ctx, const char *filename) {
+ if (ctx->state != STATE_INITIALIZED) return -1;
+ const long long n = countLines(filename);
+ if (n < 0) {
+  cout << "pcalc_add_file: cannot read file " << filename << endl;
+  return -1;
+ }
+ string name = filename;
+ gen::addFileChunk(&name[0], n);
+ ctx->nElements += n;
+ return 0;
+}
+
+int pcalc_restart(pcalc_context *ctx) {
+ if (ctx->state == STATE_CREATED || !checkConfig()) return -1;
+ printConfig(config);
+ gen::initCalc();  // the grid parameters may have changed
+ gen::beginChunks(config.pid);
+ ctx->nElements = 0;
+ ctx->state = STATE_INITIALIZED;
+ return 0;
+}
+
+int pcalc_finish(pcalc_context *ctx) {
+ if (ctx->state != STATE_INITIALIZED) return -1;
+ gen::finishChunks();
+ ctx->state = STATE_FINISHED;
+ return 0;
+}
+
+long pcalc_elements(const pcalc_context *ctx) { return ctx->nElements; }
+
+void pcalc_grid(const pcalc_context *ctx, int *npt, const double **pT,
+                int *nphi, const double **phi) {
+ *npt = gen::pT.size();
+ *nphi = gen::phi.size();
+ *pT = gen::pT.empty() ? 0 : &gen::pT[0];
+ *phi = gen::phi.empty() ? 0 : &gen::phi[0];
+}
+
+void pcalc_weights(const pcalc_context *ctx, const double **wpt,
+                   const double **wphi) {
+ *wpt = gen::wPt.empty() ? 0 : &gen::wPt[0];
+ *wphi = gen::wPhi.empty() ? 0 : &gen::wPhi[0];
+}
+
+const double *pcalc_denominator(const pcalc_context *ctx) {
+ if (ctx->state != STATE_FINISHED) return 0;
+ return &gen::Pi_den[0];
+}
+
+const double *pcalc_numerator(const pcalc_context *ctx, int term) {
+ if (ctx->state != STATE_FINISHED || term < 0 || term >= nTerms
+     || !(config.terms & (1 << term)))
+  return 0;
+ return &gen::Pi_num[term][0];
+}
+
+double pcalc_norm(const pcalc_context *ctx, int term) {
+ if (ctx->state == STATE_CREATED || term < 0 || term >= nTerms) return 0.;
+ return gen::termNorm(term);
+}
+
+int pcalc_write(pcalc_context *ctx, const char *filename) {
+ if (ctx->state != STATE_FINISHED) return -1;
+ string name = filename;
+ gen::writeOutput(&name[0]);
+ return 0;
+}
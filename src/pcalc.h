@@ -0,0 +1,98 @@
+#ifndef PCALC_H
+#define PCALC_H
+
+/* Library interface of calc (make lib): the polarization on the momentum grid
+ * from freeze-out surface elements in memory, for coupling with a hydro code
+ * in the same process. Only the polarization mode is available.
+ *
+ *   pcalc_context *ctx = pcalc_create();
+ *   pcalc_set(ctx, "params", "my.params");   // or single keys, see
+ *   pcalc_set(ctx, "terms", "all");          // params/example.params
+ *   pcalc_init(ctx);
+ *   for (...) pcalc_add_elements(ctx, &cells[0].tau, n, sizeof(cell) / sizeof(double));
+ *   pcalc_finish(ctx);
+ *   pcalc_write(ctx, "out.bin");  // and/or pcalc_denominator, pcalc_numerator
+ *   pcalc_destroy(ctx);
+ *
+ * For parameter studies the same surface can be processed again with other
+ * parameters: pcalc_set, pcalc_restart, pcalc_add_file (fast with the
+ * surface_cache), pcalc_finish. Python bindings: output/pcalc.py.
+ *
+ * The calculation uses global state, there can be only one context at a
+ * time. Errors in the parameters or tables end the process, like in calc.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* a surface element, the columns of a line of the surface file */
+typedef struct {
+ double tau, x, y, eta;
+ double dsigma[4];
+ double u[4];
+ double T, mub, muq, mus;
+ double dbeta[4][4];   /* thermal vorticity */
+ double dmuCart[4][4]; /* derivatives of u in Cartesian coordinates */
+} pcalc_element;
+
+typedef struct pcalc_context pcalc_context;
+
+/* returns 0 if a context exists already */
+pcalc_context *pcalc_create(void);
+void pcalc_destroy(pcalc_context *ctx);
+/* sets a parameter of params/example.params, key "params" reads a parameter
+   file. Returns -1 for an unknown key. The tables and threads are used by
+   pcalc_init, the other parameters (also the grid) by pcalc_init and
+   pcalc_restart. */
+int pcalc_set(pcalc_context *ctx, const char *key, const char *value);
+/* reads the particle tables and sets up the grid and the kernel for the
+   particle of the parameter pid */
+int pcalc_init(pcalc_context *ctx);
+/* Adds n elements to the sums. The element i starts at values[i*stride], with
+   the values in the order of pcalc_element (stride 0: packed pcalc_element).
+   The elements are processed and released before the function returns, the
+   caller's memory is only read. Every call is a pass over the grid with all
+   threads, batches should have at least some thousand elements.
+   With boost_invariant the elements must be one eta slice, they are
+   integrated over eta analytically (boost_invariant_deta is required). */
+int pcalc_add_elements(pcalc_context *ctx, const double *values, size_t n,
+                       size_t stride);
+/* adds the elements of a surface file (plain or compressed, with the
+   surface_cache if set); with boost_invariant only the eta slice closest
+   to 0 is used, as in calc */
+int pcalc_add_file(pcalc_context *ctx, const char *filename);
+/* ends the surface; the results below are valid afterwards, until the next
+   pcalc_finish or pcalc_restart */
+int pcalc_finish(pcalc_context *ctx);
+/* starts a new surface with the current parameters, after pcalc_init; the
+   grid is set up again, query it with pcalc_grid and pcalc_weights */
+int pcalc_restart(pcalc_context *ctx);
+/* number of elements added so far */
+long pcalc_elements(const pcalc_context *ctx);
+
+/* momentum grid: the point ip = ipt*nphi + iphi has pT[ipt], phi[iphi] */
+void pcalc_grid(const pcalc_context *ctx, int *npt, const double **pT,
+                int *nphi, const double **phi);
+/* quadrature weights of the integrals over pT and phi at the grid points
+   (parameter pt_grid); the integral over d^2pT of a grid function f is
+   sum f[ip] * pT[ipt] * wpt[ipt] * wphi[iphi] */
+void pcalc_weights(const pcalc_context *ctx, const double **wpt,
+                   const double **wphi);
+/* denominator of Eq. 34, [ip] */
+const double *pcalc_denominator(const pcalc_context *ctx);
+/* numerator of term (0 standard, 1 xi, 2 shear, 3 spin0), [ip*4 + mu];
+   0 if the term is not enabled. The polarization is
+   P^mu = pcalc_norm(term) * numerator[ip*4 + mu] / denominator[ip]. */
+const double *pcalc_numerator(const pcalc_context *ctx, int term);
+double pcalc_norm(const pcalc_context *ctx, int term);
+/* writes the output file of calc (binary for .bin or output_format) */
+int pcalc_write(pcalc_context *ctx, const char *filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PCALC_H */
@@ -0,0 +1,82 @@
+#include <omp.h>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+
+#include "progress.h"
+
+using namespace std;
+
+Progress::Progress(const string &_label, long _total, int nThreads,
+                   double _interval, const string &_heartbeatFile)
+    : label(_label),
+      heartbeatFile(_heartbeatFile),
+      total(_total),
+      interval(_interval),
+      slots(nThreads),
+      stopped(false),
+      startTime(0.) {}
+
+Progress::~Progress() {
+ if (reporter.joinable()) finish();
+}
+
+void Progress::start() {
+ startTime = omp_get_wtime();
+ if (interval > 0. || !heartbeatFile.empty())
+  reporter = thread(&Progress::run, this);
+}
+
+long Progress::done() const {
+ long n = 0;
+ for (size_t i = 0; i < slots.size(); i++)
+  n += slots[i].count.load(memory_order_relaxed);
+ return n;
+}
+
+void Progress::run() {
+ // without console output the heartbeat is written every 10 seconds
+ const double wait = interval > 0. ? interval : 10.;
+ unique_lock<mutex> lock(mtx);
+ while (!cv.wait_for(lock, chrono::duration<double>(wait),
+                     [this] { return stopped; }))
+  report(false);
+}
+
+void Progress::finish() {
+ {
+  lock_guard<mutex> lock(mtx);
+  stopped = true;
+ }
+ cv.notify_all();
+ if (reporter.joinable()) reporter.join();
+ report(true);
+}
+
+void Progress::report(bool final) {
+ const long n = done();
+ const double elapsed = omp_get_wtime() - startTime;
+ const double rate = elapsed > 0. ? n / elapsed : 0.;
+ const double eta = rate > 0. ? (total - n) / rate : -1.;
+ if (interval > 0. || final) {
+  cout << label << ": " << n << " / " << total << " ("
+       << fixed << setprecision(1) << (total > 0 ? 100.0 * n / total : 100.)
+       << "%), " << setprecision(0) << rate << " /s, "
+       << (final ? "elapsed " : "ETA ") << setprecision(1)
+       << (final ? elapsed : eta) << " s" << endl;
+  cout.unsetf(ios::floatfield);
+  cout << setprecision(6);
+ }
+ if (!heartbeatFile.empty()) {
+  // write to a temporary file and rename, so readers never see a partial line
+  const string tmp = heartbeatFile + ".tmp";
+  ofstream fhb(tmp.c_str());
+  fhb << "{\"task\": \"" << label << "\", \"done\": " << n
+      << ", \"total\": " << total << ", \"elapsed\": " << elapsed
+      << ", \"rate\": " << rate << ", \"eta\": " << eta
+      << ", \"finished\": " << (final ? "true" : "false") << "}" << endl;
+  fhb.close();
+  rename(tmp.c_str(), heartbeatFile.c_str());
+ }
+}
@@ -0,0 +1,49 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Progress reporting for long loops. Every worker thread counts its processed
+// items in its own cache line, written only by that thread, so the hot loop
+// does not touch shared memory. A reporter thread samples the counters at a
+// fixed interval and prints the throughput and the ETA. Optionally it also
+// rewrites a one-line JSON heartbeat file for batch schedulers.
+class Progress {
+public:
+ Progress(const std::string &label, long total, int nThreads, double interval,
+          const std::string &heartbeatFile);
+ ~Progress();
+ void start();
+ // called by worker thread 'thread' only; relaxed load + store, no atomic RMW
+ inline void add(int thread, long n = 1) {
+  std::atomic<long> &c = slots[thread].count;
+  c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+ }
+ // stops the reporter and prints the final summary
+ void finish();
+ long done() const;
+
+private:
+ struct alignas(64) Slot {
+  std::atomic<long> count;
+  Slot() : count(0) {}
+ };
+ std::string label, heartbeatFile;
+ long total;
+ double interval;
+ std::vector<Slot> slots;
+ std::thread reporter;
+ std::mutex mtx;
+ std::condition_variable cv;
+ bool stopped;
+ double startTime;
+ void run();
+ void report(bool final);
+};
+
+#endif // PROGRESS_H
@@ -0,0 +1,69 @@
+#include <cmath>
+#include <iostream>
+#include <cstdlib>
+
+#include "quadrature.h"
+
+using namespace std;
+
+// The nodes are the roots of the orthogonal polynomials, found with Newton
+// iterations from the usual asymptotic guesses (Numerical Recipes gauleg,
+// gaulag). The polynomials are evaluated with their three-term recurrences.
+
+void gaussLegendre(int n, double a, double b, vector<double> &x,
+                   vector<double> &w) {
+ x.assign(n, 0.);
+ w.assign(n, 0.);
+ const double xm = 0.5 * (b + a), xl = 0.5 * (b - a);
+ for (int i = 0; i < (n + 1) / 2; i++) {
+  double z = cos(M_PI * (i + 0.75) / (n + 0.5)), dp = 0.;
+  for (int iter = 0; iter < 100; iter++) {
+   double p1 = 1., p2 = 0.;
+   for (int j = 0; j < n; j++) {
+    const double p3 = p2;
+    p2 = p1;
+    p1 = ((2. * j + 1.) * z * p2 - j * p3) / (j + 1);
+   }
+   dp = n * (z * p1 - p2) / (z * z - 1.);
+   const double z1 = z;
+   z = z1 - p1 / dp;
+   if (fabs(z - z1) < 1e-15) break;
+  }
+  x[i] = xm - xl * z;
+  x[n - 1 - i] = xm + xl * z;
+  w[i] = 2. * xl / ((1. - z * z) * dp * dp);
+  w[n - 1 - i] = w[i];
+ }
+}
+
+void gaussLaguerre(int n, vector<double> &x, vector<double> &w) {
+ x.assign(n, 0.);
+ w.assign(n, 0.);
+ double z = 0.;
+ for (int i = 0; i < n; i++) {
+  if (i == 0) z = 3. / (1. + 2.4 * n);
+  else if (i == 1) z += 15. / (1. + 2.5 * n);
+  else z += (1. + 2.55 * (i - 1)) / (1.9 * (i - 1)) * (z - x[i - 2]);
+  double dp = 0., p2 = 0.;
+  int iter;
+  for (iter = 0; iter < 100; iter++) {
+   double p1 = 1.;
+   p2 = 0.;
+   for (int j = 0; j < n; j++) {
+    const double p3 = p2;
+    p2 = p1;
+    p1 = ((2. * j + 1. - z) * p2 - j * p3) / (j + 1);
+   }
+   dp = n * (p1 - p2) / z;
+   const double z1 = z;
+   z = z1 - p1 / dp;
+   if (fabs(z - z1) < 1e-14 * (1. + z)) break;
+  }
+  if (iter == 100) {
+   cout << "gaussLaguerre: no convergence for n = " << n << endl;
+   exit(1);
+  }
+  x[i] = z;
+  w[i] = -1. / (dp * n * p2);
+ }
+}
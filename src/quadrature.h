@@ -0,0 +1,14 @@
+#ifndef QUADRATURE_H
+#define QUADRATURE_H
+
+#include <vector>
+
+// Gauss quadrature nodes x and weights w for n points:
+// sum_i w[i] f(x[i]) approximates the integral of f over [a, b]
+void gaussLegendre(int n, double a, double b, std::vector<double> &x,
+                   std::vector<double> &w);
+// ... of f(x) exp(-x) over [0, inf); the weights do not include exp(-x),
+// i.e. for the integral of f(x) multiply them by exp(x[i])
+void gaussLaguerre(int n, std::vector<double> &x, std::vector<double> &w);
+
+#endif // QUADRATURE_H
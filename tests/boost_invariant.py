@@ -0,0 +1,95 @@
+# =====================================
+# checks of boost_invariant:
+# - the analytic eta integral gives the grids of the run over the full
+#   replicated surface, for a light (211) and a heavy (3122) species;
+# - the library (pcalc_add_file) gives the same grids as calc on a surface
+#   file with several eta slices
+# =====================================
+# usage (from the repository root, after make and make lib):
+#   python3 tests/boost_invariant.py [calc binary]
+# The library is found as in output/pcalc.py ($PCALC_LIB or ./libpcalc*.so).
+
+import os
+import subprocess
+import sys
+import tempfile
+import numpy as np
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'output'))
+from pcalc import Calc
+from readPolar import readPolar
+
+# a boost-invariant surface: one random slice at eta = 0, boosted to the
+# slices eta = -0.1, 0.1 (u and the tensors with upper, dsigma with a lower index)
+def makeSurface(filename, nElements=200, etas=(-0.1, 0., 0.1)):
+ rng = np.random.default_rng(1)
+ base = np.zeros((nElements, 48))
+ base[:, 0] = rng.uniform(1., 10., nElements)
+ base[:, 1:3] = rng.uniform(-8., 8., (nElements, 2))
+ base[:, 4] = rng.uniform(0.5, 2., nElements)
+ base[:, 5:7] = rng.normal(0., 0.2, (nElements, 2))
+ v = rng.normal(0., 0.5, (nElements, 2))
+ base[:, 8] = np.sqrt(1. + (v**2).sum(axis=1))
+ base[:, 9:11] = v
+ base[:, 12] = rng.uniform(0.13, 0.16, nElements)
+ base[:, 13] = rng.uniform(0., 0.05, nElements)
+ base[:, 16:48] = rng.normal(0., 0.05, (nElements, 32))
+ rows = []
+ for eta in etas:
+  ch, sh = np.cosh(eta), np.sinh(eta)
+  Lu = np.eye(4); Lu[0, 0] = Lu[3, 3] = ch; Lu[0, 3] = Lu[3, 0] = sh
+  Ll = np.eye(4); Ll[0, 0] = Ll[3, 3] = ch; Ll[0, 3] = Ll[3, 0] = -sh
+  for r in base:
+   e = r.copy()
+   e[3] = eta
+   e[4:8] = Ll @ r[4:8]
+   e[8:12] = Lu @ r[8:12]
+   e[16:32] = (Lu @ r[16:32].reshape(4, 4) @ Lu.T).ravel()
+   e[32:48] = (Lu @ r[32:48].reshape(4, 4) @ Lu.T).ravel()
+   rows.append(e)
+ np.savetxt(filename, np.array(rows), fmt='%.17g')
+
+def runCalc(calc, surface, out, params):
+ args = [calc, surface, out]
+ for k, v in params.items():
+  args += ['-' + k, str(v)]
+ subprocess.run(args, check=True, stdout=subprocess.DEVNULL)
+ return readPolar(out)[3]
+
+def compare(what, a, b, tolerance):
+ diff = np.abs(a - b).max() / np.abs(a).max()
+ print(what + ', max relative difference:', diff)
+ return diff < tolerance
+
+def main():
+ calc = sys.argv[1] if len(sys.argv) > 1 else './calc'
+ tmp = tempfile.mkdtemp()
+ passed = True
+ # the eta sum converges exponentially, 241 slices cover the integrand
+ full = os.path.join(tmp, 'full.dat')
+ makeSurface(full, nElements=40, etas=np.linspace(-6., 6., 241))
+ for pid in (211, 3122):
+  params = {'terms': 'standard,xi', 'pid': pid, 'progress_interval': 0,
+            'n_pt': 6, 'n_phi': 12}
+  a = runCalc(calc, full, os.path.join(tmp, 'full.bin'), params)
+  params['boost_invariant'] = 1
+  b = runCalc(calc, full, os.path.join(tmp, 'bi.bin'), params)
+  passed &= compare('pid %d, boost_invariant vs full surface' % pid, a, b, 1e-10)
+ params = {'terms': 'standard,xi', 'boost_invariant': 1, 'boost_invariant_deta': 0.1,
+           'progress_interval': 0, 'n_pt': 6, 'n_phi': 12}
+ surface = os.path.join(tmp, 'beta.dat')
+ makeSurface(surface)
+ a = runCalc(calc, surface, os.path.join(tmp, 'cli.bin'), params)
+ c = Calc(**params)
+ c.add_file(surface)
+ c.finish()
+ lib = os.path.join(tmp, 'lib.bin')
+ c.write(lib)
+ passed &= compare('library vs calc', a, readPolar(lib)[3], 1e-12)
+ if not passed:
+  print('FAILED')
+  sys.exit(1)
+ print('passed')
+
+if __name__ == '__main__':
+ main()